@@ -0,0 +1,92 @@
+#ifndef ASYNC_DB_HPP_INCLUDED
+#define ASYNC_DB_HPP_INCLUDED
+
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "sqlcipherxx.hpp"
+#include "sqlcipherxx_pool.hpp"
+#include "thread_pool.hpp"
+
+namespace org {
+
+/**
+ * Runs queries on a thread pool so callers can keep many in flight and
+ * overlap database I/O and lock waits with their own work. Each task leases
+ * one of the pooled connections for its duration; there are as many
+ * connections as threads, so a task never waits for a connection.
+ *
+ * Tasks run in no particular order. Work that must be ordered or atomic
+ * goes into one submit(fn), e.g. through run_in_transaction().
+ */
+class async_db {
+public:
+    typedef sqlcipherxx_pool::initializer initializer;
+    typedef std::variant<
+        std::nullptr_t,
+        sqlite3_int64,
+        double,
+        std::string,
+        std::vector<unsigned char>> value;
+
+    struct result_set {
+        std::vector<std::string> columns;
+        std::vector<std::vector<value>> rows;
+        // as of the statement's completion, for writes
+        sqlite3_int64 changes;
+        sqlite3_int64 last_insert_rowid;
+    };
+
+    async_db(
+            std::string const &filename,
+            std::size_t nthreads,
+            initializer const &init = initializer(),
+            int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+            std::string const &vfs = "");
+    virtual ~async_db();
+
+    // prepares (through the statement cache), binds params to 1..N and
+    // collects every row
+    std::future<result_set> submit(
+            std::string const &sql,
+            std::vector<value> const &params = std::vector<value>());
+
+    // what submit(sql, params) runs, on the calling thread
+    static result_set collect(
+            sqlcipherxx &db,
+            std::string const &sql,
+            std::vector<value> const &params);
+
+    // runs fn with a leased connection
+    template <typename F>
+    std::future<std::invoke_result_t<F, sqlcipherxx&>> submit(F fn);
+
+    sqlcipherxx_pool& connections();
+    thread_pool& threads();
+private:
+    sqlcipherxx_pool _M_connections;
+    // declared last, so it drains before the connections close
+    thread_pool _M_threads;
+
+    async_db(async_db const&);
+    async_db& operator=(async_db const&);
+};
+
+template <typename F>
+std::future<std::invoke_result_t<F, sqlcipherxx&>> async_db::submit(F fn) {
+    sqlcipherxx_pool *connections = &_M_connections;
+    return _M_threads.submit([connections, fn] () mutable {
+        std::shared_ptr<sqlcipherxx_pool::lease> l = connections->acquire();
+        return fn(l->get());
+    });
+}
+
+}
+
+#endif // ASYNC_DB_HPP_INCLUDED
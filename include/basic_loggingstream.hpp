@@ -2,92 +2,165 @@
 #define BASIC_LOGGINGSTREAM_HPP_INCLUDED
 
 #include <ostream>
-#include <sstream>
+#include <streambuf>
 #include <string>
+#include <thread>
+#include <type_traits>
+
+#include "log_sink.hpp"
+#include "log_timestamp.hpp"
 
 namespace org {
 
+// Appends everything written to it to a string that keeps its capacity
+// between records.
+template <
+    typename CharT,
+    typename Traits = std::char_traits<CharT>
+        >
+class basic_logbuf
+    : public std::basic_streambuf<CharT, Traits> {
+    public:
+        typedef std::basic_string<CharT, Traits> string_type;
+        typedef typename Traits::int_type int_type;
+
+        // records above this size give their memory back when cleared
+        static std::size_t const max_retained = 64 * 1024;
+
+        string_type& str() {
+            return _M_text;
+        }
+
+        void clear() {
+            if (_M_text.capacity() > max_retained)
+                string_type().swap(_M_text);
+            else
+                _M_text.clear();
+        }
+    protected:
+        virtual int_type overflow(int_type c) {
+            if (!Traits::eq_int_type(c, Traits::eof()))
+                _M_text.push_back(Traits::to_char_type(c));
+            return Traits::not_eof(c);
+        }
+
+        virtual std::streamsize xsputn(CharT const *s, std::streamsize n) {
+            _M_text.append(s, static_cast<std::size_t>(n));
+            return n;
+        }
+    private:
+        string_type _M_text;
+};
+
+// Records end up in a log_sink, which takes chars, so CharT must be char.
 template <
     typename CharT,
     typename Traits = std::char_traits<CharT>
         >
 class basic_loggingstream
     : public std::basic_ostream<CharT, Traits> {
+    static_assert(std::is_same<CharT, char>::value,
+            "basic_loggingstream: log_sink only takes char records");
     private:
         typedef std::basic_ostream<CharT, Traits> super_type;
         typedef basic_loggingstream<CharT, Traits> this_type;
-        typedef std::basic_stringbuf<CharT, Traits> buffer_type;
+        typedef basic_logbuf<CharT, Traits> buffer_type;
+
+        // one reusable buffer per thread; a record started while another
+        // is still being built on the same thread gets a buffer of its own
+        struct thread_buffer {
+            thread_buffer() : busy(false) {}
+
+            buffer_type buf;
+            bool busy;
+        };
+
+        static thread_buffer& local() {
+            static thread_local thread_buffer tb;
+            return tb;
+        }
     public:
         basic_loggingstream(
                 std::string const &name,
-                std::ostream *stream,
-                std::mutex *mutex)
+                log_sink *sink)
             : super_type(NULL)
-            , _M_buf(new buffer_type())
-            , _M_name(name)
-            , _M_stream(stream)
-            , _M_mutex(mutex)
+            , _M_buf(NULL)
+            , _M_owned(false)
+            , _M_sink(sink)
         {
+            thread_buffer &tb = local();
+            if (tb.busy) {
+                _M_buf = new buffer_type();
+                _M_owned = true;
+            } else {
+                tb.busy = true;
+                _M_buf = &tb.buf;
+            }
             super_type::rdbuf(_M_buf);
+            try {
+                timestamp();
+            } catch (...) {
+                release();
+                throw;
+            }
+            *this << " " << name
+                << " " << std::this_thread::get_id()
+                << " ";
         }
 
         basic_loggingstream(this_type const &other)
-            : _M_buf(NULL)
-            , _M_name(other._M_name)
-            , _M_stream(other._M_stream)
-            , _M_mutex(other._M_mutex)
+            : super_type(NULL)
+            , _M_buf(NULL)
+            , _M_owned(false)
+            , _M_sink(other._M_sink)
         {
             std::swap(_M_buf, other._M_buf);
+            std::swap(_M_owned, other._M_owned);
+            super_type::rdbuf(_M_buf);
         }
 
         virtual ~basic_loggingstream() {
-            print();
+            if (!_M_buf)
+                return;
+            try {
+                print();
+            } catch (...) {
+            }
+            release();
         }
     protected:
     private:
-        std::string timestamp() {
-            time_t now = std::time(NULL);
-            if (now == static_cast<time_t>(-1))
-                throw std::runtime_error("std::time");
-            struct tm tm;
-            // FIXME non standard localtime_r
-            if (!localtime_r(&now, &tm))
-                throw std::runtime_error("localtime_r");
-            std::vector<char> buffer(30, 0);
-            if (!std::strftime(
-                        &buffer[0],
-                        buffer.size(),
-                        "%Y-%m-%d %H:%M:%S %z",
-                        &tm))
-                throw std::runtime_error("strftime");
-            return &buffer[0];
+        // written straight into the record, a std::string would not fit SSO
+        void timestamp() {
+            char buffer[log_timestamp::buffer_size];
+            log_timestamp::format(buffer);
+            *this << buffer;
+        }
+
+        void release() {
+            _M_buf->clear();
+            if (_M_owned)
+                delete _M_buf;
+            else
+                local().busy = false;
+            _M_buf = NULL;
         }
 
         void print() {
-            if (!_M_buf || !_M_stream)
-                return;
-            std::ostringstream oss;
-            oss << timestamp()
-                << " " << _M_name
-                << " " << std::this_thread::get_id()
-                << " " <<  _M_buf << std::endl;
-            std::ostream &out = *_M_stream;
-            if (!_M_mutex) {
-                out << oss.str() << std::flush;
+            if (!_M_sink)
                 return;
-            }
-            std::unique_lock<std::mutex> locker(*_M_mutex);
-            out << oss.str() << std::flush;
+            typename buffer_type::string_type &line = _M_buf->str();
+            line.push_back('\n');
+            // the sink does the locking and flushing, if any
+            _M_sink->write(line.data(), line.size());
         }
 
         mutable buffer_type *_M_buf;
-        std::string _M_name;
-        std::ostream *_M_stream;
-        std::mutex *_M_mutex;
+        mutable bool _M_owned;
+        log_sink *_M_sink;
 };
 
 typedef basic_loggingstream<char> loggingstream;
-typedef basic_loggingstream<wchar_t> wloggingstream;
 
 } // namespace org
 
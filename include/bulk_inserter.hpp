@@ -0,0 +1,124 @@
+#ifndef BULK_INSERTER_HPP_INCLUDED
+#define BULK_INSERTER_HPP_INCLUDED
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "sqlcipherxx.hpp"
+
+namespace org {
+
+/**
+ * Buffers rows for one table and writes them with multi-row
+ * INSERT ... VALUES (?,?),(?,?)... statements sized to
+ * SQLITE_LIMIT_VARIABLE_NUMBER, committing through a sqlcipherxx::transaction
+ * every batch_size rows. Inside a transaction the caller already has open,
+ * each batch goes into a savepoint instead and is released into the
+ * caller's transaction, which still decides whether the rows are kept.
+ *
+ * Values are copied when inserted, so callers may pass temporaries. Pending
+ * rows are written and committed by flush() and by the destructor.
+ *
+ * If a write or commit fails, every row since the last commit is rolled back
+ * and the error rethrown; the inserter can be used again afterwards.
+ * inserted() only counts committed (or released) rows.
+ */
+class bulk_inserter {
+public:
+    bulk_inserter(
+            sqlcipherxx &db,
+            std::string const &table,
+            std::vector<std::string> const &columns,
+            std::size_t batch_size = 1000);
+    virtual ~bulk_inserter();
+
+    template <typename... Args>
+    void insert(Args const&... values);
+
+    void flush();
+    void rollback();
+
+    std::size_t rows_per_statement() const;
+    std::size_t inserted() const;
+private:
+    struct cell {
+        int type;
+        sqlite3_int64 i;
+        double d;
+        std::string bytes;
+    };
+
+    template <typename T>
+    static void stage(cell &c, T const &value);
+
+    void row_staged();
+    void write();
+    std::string values_sql(std::size_t nrows) const;
+
+    sqlcipherxx &_M_db;
+    std::string _M_prefix;
+    std::size_t _M_ncols;
+    std::size_t _M_batch_size;
+    std::size_t _M_rows_per_stmt;
+    std::vector<cell> _M_cells;
+    std::size_t _M_pending;
+    std::size_t _M_uncommitted;
+    std::size_t _M_inserted;
+    std::shared_ptr<sqlcipherxx::statement> _M_stmt;
+    std::shared_ptr<sqlcipherxx::transaction> _M_tran;
+    std::shared_ptr<sqlcipherxx::savepoint> _M_savepoint;
+
+    bulk_inserter(bulk_inserter const&);
+    bulk_inserter& operator=(bulk_inserter const&);
+};
+
+template <typename... Args>
+inline void bulk_inserter::insert(Args const&... values) {
+    if (sizeof...(Args) != _M_ncols)
+        throw std::invalid_argument("bulk_inserter: column count mismatch");
+    std::size_t icell = _M_pending * _M_ncols;
+    (stage(_M_cells[icell++], values), ...);
+    row_staged();
+}
+
+template <typename T>
+inline void bulk_inserter::stage(cell &c, T const &value) {
+    typedef typename std::decay<T>::type type;
+    if constexpr (std::is_same<type, std::nullptr_t>::value) {
+        c.type = SQLITE_NULL;
+    } else if constexpr (std::is_integral<type>::value) {
+        c.type = SQLITE_INTEGER;
+        c.i = static_cast<sqlite3_int64>(value);
+    } else if constexpr (std::is_floating_point<type>::value) {
+        c.type = SQLITE_FLOAT;
+        c.d = static_cast<double>(value);
+    } else if constexpr (std::is_same<type, sqlcipherxx::blob_view>::value
+            || std::is_same<type, std::vector<unsigned char> >::value) {
+        c.type = SQLITE_BLOB;
+        c.bytes.assign(
+                reinterpret_cast<char const*>(value.data()),
+                value.size());
+    } else if constexpr (std::is_pointer<T>::value) {
+        // string literals are arrays and never null, they go below
+        static_assert(std::is_convertible<type, char const*>::value,
+                "bulk_inserter: unsupported pointer type");
+        c.type = value ? SQLITE_TEXT : SQLITE_NULL;
+        if (value)
+            c.bytes.assign(value);
+    } else {
+        static_assert(std::is_convertible<type, std::string_view>::value,
+                "bulk_inserter: unsupported value type");
+        c.type = SQLITE_TEXT;
+        std::string_view text(value);
+        c.bytes.assign(text.data(), text.size());
+    }
+}
+
+}
+
+#endif // BULK_INSERTER_HPP_INCLUDED
@@ -0,0 +1,74 @@
+#ifndef BUSY_POLICY_HPP_INCLUDED
+#define BUSY_POLICY_HPP_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace org {
+
+/**
+ * Decides how long a connection waits when SQLite reports SQLITE_BUSY.
+ * Installed through sqlcipherxx::set_busy_policy(), which registers it with
+ * sqlite3_busy_handler. One policy may be shared by many connections, its
+ * counters are aggregated over all of them.
+ *
+ * The n-th wait of a busy event sleeps
+ * min(initial_delay * multiplier^n, max_delay), of which a jitter fraction is
+ * randomised. The event gives up once timeout has elapsed or max_retries
+ * waits were spent; zero disables either limit.
+ */
+class busy_policy {
+public:
+    struct options {
+        options();
+
+        std::chrono::milliseconds timeout;
+        std::chrono::microseconds initial_delay;
+        std::chrono::microseconds max_delay;
+        double multiplier;
+        double jitter;
+        int max_retries;
+    };
+
+    struct statistics {
+        std::uint64_t events;
+        std::uint64_t waits;
+        std::uint64_t gave_up;
+        std::chrono::microseconds waited;
+    };
+
+    static options fixed(
+            std::chrono::milliseconds timeout,
+            std::chrono::microseconds interval = std::chrono::milliseconds(1));
+    static options exponential(
+            std::chrono::milliseconds timeout,
+            std::chrono::microseconds initial_delay = std::chrono::microseconds(100),
+            std::chrono::microseconds max_delay = std::chrono::milliseconds(50),
+            double jitter = 0.5);
+
+    explicit busy_policy(options const &opts = options());
+    virtual ~busy_policy();
+
+    // called by the busy handler, returns false to give up
+    bool wait(int count);
+
+    options const& get_options() const;
+    statistics stats() const;
+    void reset_stats();
+private:
+    std::chrono::microseconds delay(int count) const;
+
+    options _M_options;
+    std::atomic<std::uint64_t> _M_events;
+    std::atomic<std::uint64_t> _M_waits;
+    std::atomic<std::uint64_t> _M_gave_up;
+    std::atomic<std::int64_t> _M_waited_us;
+
+    busy_policy(busy_policy const&);
+    busy_policy& operator=(busy_policy const&);
+};
+
+}
+
+#endif // BUSY_POLICY_HPP_INCLUDED
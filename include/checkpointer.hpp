@@ -0,0 +1,97 @@
+#ifndef CHECKPOINTER_HPP_INCLUDED
+#define CHECKPOINTER_HPP_INCLUDED
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sqlcipherxx.hpp"
+
+namespace org {
+
+/**
+ * Moves WAL checkpoints off the commit path. The watched connection's
+ * auto-checkpoint is replaced by a wal hook that only records the WAL size;
+ * a background thread checkpoints through a connection of its own:
+ *
+ *   PASSIVE  once passive_frames frames are waiting to be copied back,
+ *   RESTART  once the WAL holds restart_frames frames, so the next writer
+ *            starts over at its beginning instead of growing it further,
+ *   TRUNCATE after the database has been idle for idle_time, which also
+ *            gives the WAL file's disk space back.
+ *
+ * RESTART and TRUNCATE wait up to busy_timeout for readers and fall back to
+ * PASSIVE. The initializer runs on the checkpointer's connection right after
+ * it is opened, e.g. to key it. The database must already be in WAL mode.
+ *
+ * Only the watched connection's commits are seen; attach the other writers
+ * with watch(). Watched connections must outlive the checkpointer and be
+ * idle while it is destroyed, as that puts their auto-checkpoint back.
+ */
+class checkpointer {
+public:
+    typedef std::function<void(sqlcipherxx&)> initializer;
+
+    struct options {
+        options();
+
+        int passive_frames;
+        int restart_frames;
+        std::chrono::milliseconds idle_time;
+        int busy_timeout;
+    };
+
+    struct statistics {
+        std::uint64_t passive;
+        std::uint64_t restart;
+        std::uint64_t truncate;
+        std::uint64_t busy;
+        // frames copied back into the database
+        std::uint64_t frames;
+    };
+
+    explicit checkpointer(
+            sqlcipherxx &db,
+            options const &opts = options(),
+            initializer const &init = initializer());
+    virtual ~checkpointer();
+
+    void watch(sqlcipherxx &db);
+
+    statistics stats() const;
+private:
+    void committed(int frames);
+    void run();
+    void checkpoint(int mode);
+
+    options _M_options;
+    sqlcipherxx _M_db;
+    std::vector<sqlcipherxx*> _M_watched;
+    // WAL frames as of the last commit, and how many of them have been
+    // copied back
+    int _M_frames;
+    int _M_backfilled;
+    // a TRUNCATE is due once idle
+    bool _M_dirty;
+    std::uint64_t _M_commits;
+    std::uint64_t _M_seen;
+    std::chrono::steady_clock::time_point _M_last_commit;
+    std::chrono::steady_clock::time_point _M_last_attempt;
+    bool _M_stopping;
+    statistics _M_stats;
+    mutable std::mutex _M_mutex;
+    std::condition_variable _M_cond;
+    std::thread _M_thread;
+
+    checkpointer(checkpointer const&);
+    checkpointer& operator=(checkpointer const&);
+};
+
+}
+
+#endif // CHECKPOINTER_HPP_INCLUDED
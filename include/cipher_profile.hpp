@@ -0,0 +1,43 @@
+#ifndef CIPHER_PROFILE_HPP_INCLUDED
+#define CIPHER_PROFILE_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+
+namespace org {
+
+/**
+ * SQLCipher settings applied to a connection right after it is keyed, before
+ * the first page is read. Page size and HMAC choice drive the crypto cost per
+ * byte; the KDF settings also select what kdf_cache derives.
+ *
+ * Presets:
+ *   "compat-v4"  SQLCipher 4 defaults, 4 KiB pages
+ *   "throughput" 16 KiB pages, amortising per-page IV and HMAC over more data
+ *   "low-memory" 1 KiB pages, for small page caches
+ *
+ * A database must always be opened with the profile it was created with.
+ */
+struct cipher_profile {
+    cipher_profile();
+
+    int page_size;
+    int kdf_iter;
+    std::string kdf_algorithm;
+    std::string hmac_algorithm;
+    bool use_hmac;
+    int plaintext_header_size;
+
+    static cipher_profile compat_v4();
+    static cipher_profile throughput();
+    static cipher_profile low_memory();
+    // looks a preset up by name, throws std::invalid_argument if unknown
+    static cipher_profile preset(std::string const &name);
+
+    // PRAGMA statements for the given schema ("" for main)
+    std::vector<std::string> pragmas(std::string const &schema = "") const;
+};
+
+}
+
+#endif // CIPHER_PROFILE_HPP_INCLUDED
@@ -0,0 +1,79 @@
+#ifndef GROUP_COMMITTER_HPP_INCLUDED
+#define GROUP_COMMITTER_HPP_INCLUDED
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sqlcipherxx.hpp"
+
+namespace org {
+
+/**
+ * Funnels write closures from many threads onto one writer connection and
+ * runs everything that queued up meanwhile inside a single BEGIN IMMEDIATE
+ * transaction, so N small writes cost one commit (and one WAL sync).
+ *
+ * Every closure runs in its own savepoint: one that throws is rolled back
+ * and fails its own future without affecting the rest of the batch. If
+ * SQLite rolls back the whole transaction instead, the rest of the batch is
+ * not run and every future in it fails. BEGIN and COMMIT are retried on
+ * SQLITE_BUSY, closures never are. The futures complete only after the
+ * batch has committed. The writer connection must not be used by anyone
+ * else while the committer lives.
+ */
+class group_committer {
+public:
+    typedef std::function<void(sqlcipherxx&)> work;
+
+    struct statistics {
+        std::uint64_t batches;
+        std::uint64_t writes;
+        std::uint64_t failed;
+        std::uint64_t retries;
+    };
+
+    explicit group_committer(
+            sqlcipherxx &writer,
+            std::size_t max_batch = 256,
+            std::chrono::microseconds linger = std::chrono::microseconds(0),
+            sqlcipherxx::retry_policy const &retry = sqlcipherxx::retry_policy());
+    virtual ~group_committer();
+
+    std::future<void> submit(work const &fn);
+
+    statistics stats() const;
+private:
+    struct request {
+        work fn;
+        std::promise<void> done;
+    };
+
+    void run();
+    void commit(std::vector<request> &batch);
+
+    sqlcipherxx &_M_db;
+    std::size_t _M_max_batch;
+    std::chrono::microseconds _M_linger;
+    sqlcipherxx::retry_policy _M_retry;
+    std::deque<request> _M_queue;
+    bool _M_stopping;
+    statistics _M_stats;
+    mutable std::mutex _M_mutex;
+    std::condition_variable _M_cond;
+    std::thread _M_thread;
+
+    group_committer(group_committer const&);
+    group_committer& operator=(group_committer const&);
+};
+
+}
+
+#endif // GROUP_COMMITTER_HPP_INCLUDED
@@ -0,0 +1,55 @@
+#ifndef KDF_CACHE_HPP_INCLUDED
+#define KDF_CACHE_HPP_INCLUDED
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace org {
+
+/**
+ * Process-wide cache of SQLCipher key derivations. Deriving a database key
+ * from a passphrase runs PBKDF2 (256000 iterations by default in SQLCipher
+ * 4) on every open; the cache runs it once per (passphrase, salt, KDF
+ * settings) and hands the result to sqlcipherxx::key_raw(), which skips the
+ * KDF entirely.
+ *
+ * Entries are keyed by a SHA-256 of the passphrase, but the derived keys
+ * themselves stay in memory until clear() wipes them.
+ */
+class kdf_cache {
+public:
+    typedef std::vector<unsigned char> bytes;
+
+    virtual ~kdf_cache();
+
+    static kdf_cache* instance();
+
+    // algorithm is a SQLCipher cipher_kdf_algorithm name, e.g.
+    // "PBKDF2_HMAC_SHA512"
+    bytes derive(
+            std::string const &passphrase,
+            bytes const &salt,
+            int iterations,
+            std::string const &algorithm,
+            std::size_t key_size = 32);
+
+    std::size_t size() const;
+    void clear();
+
+    static bytes random_bytes(std::size_t n);
+protected:
+    kdf_cache();
+private:
+    mutable std::mutex _M_mutex;
+    std::map<std::string, bytes> _M_keys;
+
+    kdf_cache(kdf_cache const&);
+    kdf_cache& operator=(kdf_cache const&);
+};
+
+}
+
+#endif // KDF_CACHE_HPP_INCLUDED
@@ -0,0 +1,65 @@
+#ifndef LOG_RING_HPP_INCLUDED
+#define LOG_RING_HPP_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace org {
+
+/**
+ * Bounded lock-free queue of log records, many producers and one consumer
+ * (D. Vyukov's bounded MPMC queue with the consumer side simplified). Each
+ * cell owns a std::string that keeps its capacity, so once the ring has
+ * warmed up pushing a record copies bytes but does not allocate.
+ */
+class log_ring {
+public:
+    // capacity is rounded up to a power of two
+    explicit log_ring(std::size_t capacity);
+    virtual ~log_ring();
+
+    // false when the ring is full
+    bool push(char const *data, std::size_t size);
+
+    // consumer only: hands the oldest record to fn, false when empty
+    template <typename F>
+    bool pop(F const &fn);
+
+    std::size_t capacity() const;
+    // records pushed/popped so far
+    std::size_t pushed() const;
+    std::size_t popped() const;
+private:
+    struct cell {
+        std::atomic<std::size_t> sequence;
+        std::string data;
+    };
+
+    std::unique_ptr<cell[]> _M_cells;
+    std::size_t _M_mask;
+    alignas(64) std::atomic<std::size_t> _M_tail;
+    alignas(64) std::atomic<std::size_t> _M_head;
+
+    log_ring(log_ring const&);
+    log_ring& operator=(log_ring const&);
+};
+
+template <typename F>
+bool log_ring::pop(F const &fn) {
+    std::size_t head = _M_head.load(std::memory_order_relaxed);
+    cell &c = _M_cells[head & _M_mask];
+    if (c.sequence.load(std::memory_order_acquire) != head + 1)
+        return false;
+    fn(c.data);
+    c.data.clear();
+    // the cell is free for the producer one lap ahead
+    c.sequence.store(head + _M_mask + 1, std::memory_order_release);
+    _M_head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+}
+
+#endif // LOG_RING_HPP_INCLUDED
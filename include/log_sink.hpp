@@ -0,0 +1,104 @@
+#ifndef LOG_SINK_HPP_INCLUDED
+#define LOG_SINK_HPP_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#include "log_ring.hpp"
+
+namespace org {
+
+// Where basic_loggingstream hands its finished, newline-terminated records.
+class log_sink {
+    public:
+        virtual ~log_sink();
+
+        virtual void write(char const *data, std::size_t size) = 0;
+        // returns once everything written so far has reached the stream
+        virtual void flush() = 0;
+};
+
+// Writes and flushes each record under a mutex, on the logging thread.
+class ostream_sink : public log_sink {
+    public:
+        ostream_sink(std::ostream *stream, std::mutex *mutex);
+        virtual ~ostream_sink();
+
+        virtual void write(char const *data, std::size_t size);
+        virtual void flush();
+
+        std::ostream* stream() const;
+    private:
+        std::ostream *_M_stream;
+        std::mutex *_M_mutex;
+};
+
+/**
+ * Queues records on a log_ring and writes them from a background thread in
+ * batches, flushing whenever it has caught up, so logging threads never take
+ * a lock or touch the stream. When the ring is full the record is
+ *
+ *   block  retried until the writer makes room,
+ *   drop   discarded,
+ *   count  discarded, and the writer later logs how many were lost.
+ *
+ * The stream must outlive the sink; the destructor writes out what is
+ * still queued.
+ */
+class async_sink : public log_sink {
+    public:
+        enum overflow_policy {
+            block,
+            drop,
+            count
+        };
+
+        struct options {
+            options();
+
+            std::size_t capacity;
+            overflow_policy overflow;
+            // records per write to the stream
+            std::size_t batch_size;
+            // how long the writer sleeps when it has nothing to do
+            std::chrono::milliseconds idle_wait;
+        };
+
+        async_sink(std::ostream *stream, options const &opts = options());
+        virtual ~async_sink();
+
+        virtual void write(char const *data, std::size_t size);
+        virtual void flush();
+
+        std::uint64_t dropped() const;
+    private:
+        void run();
+        void wake();
+
+        std::ostream *_M_stream;
+        options _M_options;
+        log_ring _M_ring;
+        std::atomic<std::uint64_t> _M_dropped;
+        std::atomic<bool> _M_sleeping;
+        std::atomic<bool> _M_stopping;
+        // records the writer has written and flushed, guarded by _M_mutex
+        std::size_t _M_flushed;
+        std::mutex _M_mutex;
+        std::condition_variable _M_wakeup;
+        std::condition_variable _M_flushed_cond;
+        std::thread _M_thread;
+
+        async_sink(async_sink const&);
+        async_sink& operator=(async_sink const&);
+};
+
+}
+
+#endif // LOG_SINK_HPP_INCLUDED
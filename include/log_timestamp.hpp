@@ -0,0 +1,40 @@
+#ifndef LOG_TIMESTAMP_HPP_INCLUDED
+#define LOG_TIMESTAMP_HPP_INCLUDED
+
+#include <cstddef>
+
+namespace org {
+
+/**
+ * Formats the time at the start of each log record. The calendar part is
+ * cached per thread and only rebuilt (through localtime_r, which takes the
+ * libc timezone lock, and strftime) when the second changes; everything
+ * below a second is plain integer formatting.
+ *
+ *   seconds       2024-01-31 12:34:56 +0800
+ *   microseconds  2024-01-31 12:34:56.123456 +0800
+ *   monotonic     1234.567890, seconds since the first record, from
+ *                 steady_clock, so immune to wall clock adjustments
+ */
+class log_timestamp {
+    public:
+        enum mode {
+            seconds,
+            microseconds,
+            monotonic
+        };
+
+        // large enough for every mode, including the terminating NUL
+        static std::size_t const buffer_size = 48;
+
+        // process-wide, takes effect on each thread's next record
+        static void set_mode(mode m);
+        static mode get_mode();
+
+        // writes the current time and a NUL to out, returns the length
+        static std::size_t format(char *out);
+};
+
+}
+
+#endif // LOG_TIMESTAMP_HPP_INCLUDED
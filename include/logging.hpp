@@ -1,15 +1,20 @@
 #ifndef LOGGING_HPP_INCLUDED
 #define LOGGING_HPP_INCLUDED
 
+#include <atomic>
+#include <cstdint>
 #include <iomanip>
 #include <sstream>
 #include <ostream>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <mutex>
 #include <thread>
 
 #include "basic_loggingstream.hpp"
+#include "log_sink.hpp"
+#include "log_timestamp.hpp"
 
 namespace org {
 
@@ -32,11 +37,31 @@ class logging {
         loggingstream error();
 
         std::mutex* get_mutex();
+
+        // Hands records to a background writer instead of writing them on
+        // the logging thread, see async_sink. Neither this nor stop_async()
+        // nor tie() may race with threads that are logging.
+        void start_async(async_sink::options const &opts = async_sink::options());
+        // writes out what is queued and goes back to synchronous logging
+        void stop_async();
+        bool is_async() const;
+        // returns once every record logged so far has reached the stream
+        void flush();
+        // records lost to a full ring in async mode
+        std::uint64_t dropped() const;
+
+        // see log_timestamp
+        void set_timestamp_mode(log_timestamp::mode m);
     protected:
         logging(std::ostream *stream);
     private:
         std::ostream *_M_stream;
         std::mutex _M_mutex;
+        ostream_sink _M_sync;
+        async_sink::options _M_async_options;
+        std::unique_ptr<async_sink> _M_async;
+        std::atomic<log_sink*> _M_sink;
+        std::uint64_t _M_dropped;
 };
 
 }
@@ -1,15 +1,79 @@
 #ifndef SQLCIPHERXX_HPP_INCLUDED
 #define SQLCIPHERXX_HPP_INCLUDED
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
 #include <memory>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <sqlite3.h>
 
+#include "cipher_profile.hpp"
+
 namespace org {
 
+class busy_policy;
+
+std::error_category const& sqlite_category();
+
+std::error_code make_sqlite_error(int ecode);
+
+// true for SQLITE_BUSY and SQLITE_LOCKED, including their extended codes
+bool is_busy(std::error_code const &ec);
+
+// Thrown for every failed SQLite call; code() carries the result code.
+class sqlite_error : public std::runtime_error {
+public:
+    sqlite_error(std::error_code const &ec, std::string const &what);
+
+    std::error_code const& code() const;
+private:
+    std::error_code _M_code;
+};
+
+// Maps a C++ type onto the sqlite3_bind_*/sqlite3_column_* pair used by
+// statement::bind<T>() and statement::get<T>(). Types without a
+// specialization are rejected at compile time.
+template <typename T, typename Enable = void>
+struct value_traits;
+
+template <typename... Ts>
+class row_range;
+
 class sqlcipherxx {
 public:
+    // Non-owning view of a BLOB cell or other raw bytes.
+    class blob_view {
+        public:
+            blob_view() : _M_data(NULL), _M_size(0) {}
+            blob_view(void const *data, std::size_t size)
+                : _M_data(static_cast<unsigned char const*>(data))
+                , _M_size(size)
+            {
+            }
+
+            unsigned char const* data() const { return _M_data; }
+            std::size_t size() const { return _M_size; }
+            bool empty() const { return _M_size == 0; }
+            unsigned char const* begin() const { return _M_data; }
+            unsigned char const* end() const { return _M_data + _M_size; }
+            unsigned char operator[](std::size_t i) const { return _M_data[i]; }
+        private:
+            unsigned char const *_M_data;
+            std::size_t _M_size;
+    };
+
     class statement {
         public:
             statement();
@@ -17,16 +81,48 @@ public:
 
             bool execute();
             bool next();
+            // non-throwing variants, failures are reported through ec
+            bool try_execute(std::error_code &ec);
+            bool try_next(std::error_code &ec);
+            void reset();
+            void clear_bindings();
 
             int ncols();
+            int nparams();
+            bool readonly() const;
             std::string colname(int icol);
             bool is_null(int icol);
+            // SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT, SQLITE_BLOB or
+            // SQLITE_NULL
+            int coltype(int icol);
             std::string get_string(int icol, bool *null = NULL);
             double get_double(int icol, bool *null = NULL);
+            sqlite3_int64 get_int64(int icol, bool *null = NULL);
+            // views stay valid until the next next()/execute()/reset()
+            std::string_view get_view(int icol, bool *null = NULL);
+            blob_view get_blob(int icol, bool *null = NULL);
             void set_string(int icol, std::string const&);
             void set_double(int icol, double const&);
+            void set_int64(int icol, sqlite3_int64);
+            // text and blobs are bound without copying, so the bytes must
+            // stay alive until the statement is stepped and reset
+            void set_view(int icol, std::string_view);
+            void set_blob(int icol, blob_view const&);
+            void set_zeroblob(int icol, std::size_t);
             void set_null(int icol);
 
+            template <typename T>
+            void bind(int icol, T const &value);
+            template <typename T>
+            T get(int icol);
+
+            // binds args to parameters 1..N, N must match nparams()
+            template <typename... Args>
+            void bind_all(Args const&... args);
+            // steps through the result set decoding each row as a tuple
+            template <typename... Ts>
+            row_range<Ts...> rows();
+
             std::string sql() const;
             std::string expanded_sql() const;
             void throws(int ecode, std::string const&);
@@ -62,6 +158,8 @@ public:
             virtual ~transaction();
             void commit();
             void rollback();
+            // rolls back if possible and never throws
+            void abandon();
         protected:
             explicit transaction(sqlcipherxx&);
         private:
@@ -70,6 +168,97 @@ public:
             friend class sqlcipherxx;
     };
 
+    // SAVEPOINT/RELEASE scope. Inside a transaction it nests a unit of work
+    // that can be undone alone; outside one it starts a deferred transaction
+    // that the outermost release() commits.
+    class savepoint {
+        public:
+            virtual ~savepoint();
+            void release();
+            // undoes the changes and ends the savepoint
+            void rollback();
+            // undoes the changes but keeps the savepoint open
+            void rollback_to();
+            std::string const& name() const;
+        protected:
+            savepoint(sqlcipherxx&, std::string const&);
+        private:
+            sqlcipherxx &_M_s;
+            std::string _M_name;
+            bool _M_completed;
+            friend class sqlcipherxx;
+    };
+
+    // Called with (done, total); returning false cancels with
+    // SQLITE_INTERRUPT. Units are bytes for export_to(), pages for backup.
+    typedef std::function<bool(std::int64_t, std::int64_t)> progress_callback;
+
+    // Online page-by-page copy into another open connection (sqlite3_backup).
+    // The source is only read-locked while a step copies its pages, so
+    // writers get in between steps; small steps and a sleep keep their
+    // latency bounded. Writes from other connections restart the copy,
+    // writes through the source connection are folded in.
+    //
+    // Both ends go through their own codec, so an encrypted source can be
+    // copied into a destination keyed with another passphrase, as long as
+    // both use the same page size and HMAC setting (cipher_profile). For a
+    // plaintext copy, or one with a different profile, use export_to().
+    class backup {
+        public:
+            virtual ~backup();
+            // copies up to pages_per_step pages, returns false when done;
+            // a busy source or destination counts as a step with no progress
+            bool step();
+            // steps to the end, sleeping between steps
+            void run(progress_callback const &progress = progress_callback());
+            int remaining() const;
+            int pagecount() const;
+        protected:
+            backup(sqlite3_backup*, int, std::chrono::microseconds);
+        private:
+            sqlite3_backup *_M_backup;
+            int _M_pages_per_step;
+            std::chrono::microseconds _M_sleep;
+            bool _M_done;
+            friend class sqlcipherxx;
+    };
+
+    // A point in a WAL database's history (sqlite3_snapshot). Any connection
+    // to the same file can start a read transaction on it, so several
+    // readers see exactly the same data. Stays usable until a checkpoint
+    // restarts the WAL past it; an open read transaction anywhere on the
+    // file prevents that. Needs SQLite and this library built with
+    // SQLITE_ENABLE_SNAPSHOT (the SQLCIPHERXX_ENABLE_SNAPSHOT CMake option),
+    // see snapshot_supported(); otherwise the snapshot calls throw.
+    class snapshot {
+        public:
+            virtual ~snapshot();
+            sqlite3_snapshot* get() const;
+        protected:
+            explicit snapshot(sqlite3_snapshot*);
+        private:
+            sqlite3_snapshot *_M_snapshot;
+            friend class sqlcipherxx;
+    };
+
+    enum transaction_kind {
+        deferred,
+        immediate,
+        exclusive
+    };
+
+    // How run_in_transaction() and run_with_retry() retry work that failed
+    // with SQLITE_BUSY or SQLITE_LOCKED (BUSY_SNAPSHOT and friends included).
+    // on_retry is called before each retry with the failed attempt number.
+    struct retry_policy {
+        retry_policy();
+
+        int max_attempts;
+        std::chrono::microseconds initial_delay;
+        std::chrono::microseconds max_delay;
+        std::function<void(int, std::error_code const&)> on_retry;
+    };
+
     sqlcipherxx();
     sqlcipherxx(
             std::string const &filename,
@@ -82,15 +271,108 @@ public:
             std::string const& filename,
             int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
             std::string const &vfs = "");
+    // the profile is applied by key()/key_raw()
+    sqlcipherxx& open(
+            std::string const& filename,
+            cipher_profile const &profile,
+            int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+            std::string const &vfs = "");
     void close();
+    void set_cipher_profile(cipher_profile const&);
+    cipher_profile const& get_cipher_profile() const;
+
+    // SQLCipher keying, call right after open(). key() derives the key
+    // through the process-wide kdf_cache and passes it on as a raw key
+    // once the file has a salt; until then (a new file) it is the same as
+    // PRAGMA key. key_raw() takes a 32-byte key and an optional 16-byte
+    // salt.
+    void key(std::string const &passphrase);
+    void key_raw(blob_view const &key, blob_view const &salt = blob_view());
+    void rekey(std::string const &passphrase);
+
+    // Copies the database into a new file through sqlcipher_export, keyed
+    // with passphrase (plaintext when empty). Holds only a read transaction.
+    void export_to(
+            std::string const &filename,
+            std::string const &passphrase,
+            progress_callback const &progress = progress_callback());
+
+    // Re-encrypts with a new passphrase by exporting a copy and renaming
+    // it over the original, then reopens this connection on the new file.
+    // Unlike rekey(), the original stays intact until the rename and the
+    // copy gets a fresh salt. It blocks: the database must be in WAL mode
+    // and this must be its only open connection (otherwise it throws
+    // SQLITE_BUSY without changing anything), and the file stays locked
+    // against new connections until the copy is done.
+    void rekey_exclusive(
+            std::string const &passphrase,
+            progress_callback const &progress = progress_callback());
+
     void execute(std::string const &sql);
+    bool try_execute(std::string const &sql, std::error_code &ec);
     std::shared_ptr<transaction> begin_transaction();
     std::shared_ptr<transaction> begin_deferred();
     std::shared_ptr<transaction> begin_exclusive();
     std::shared_ptr<transaction> begin_immediate();
+    std::shared_ptr<transaction> begin(transaction_kind);
+    // an empty name picks a unique one
+    std::shared_ptr<savepoint> begin_savepoint(std::string const &name = "");
+    // Records the state the current read transaction sees, or, outside a
+    // transaction, the latest committed state.
+    std::shared_ptr<snapshot> snapshot_get(std::string const &schema = "main");
+    // Begins a read transaction on the snapshot; reads inside it see the
+    // database as it was when the snapshot was taken.
+    std::shared_ptr<transaction> snapshot_open(
+            snapshot const&,
+            std::string const &schema = "main");
+    // <0, 0 or >0 as a is older than, the same as or newer than b; only
+    // meaningful for snapshots of the same database file
+    static int snapshot_cmp(snapshot const &a, snapshot const &b);
+    static bool snapshot_supported();
+    // copies this database ("main") into dest's "main"
+    std::shared_ptr<backup> begin_backup(
+            sqlcipherxx &dest,
+            int pages_per_step = 64,
+            std::chrono::microseconds sleep = std::chrono::milliseconds(10));
+    // runs fn inside a transaction, returns the number of attempts it took
+    int run_in_transaction(
+            transaction_kind kind,
+            std::function<void(sqlcipherxx&)> const &fn,
+            retry_policy const &policy = retry_policy());
+    // calls fn again while it fails with SQLITE_BUSY or SQLITE_LOCKED,
+    // returns the number of attempts it took
+    static int run_with_retry(
+            std::function<void()> const &fn,
+            retry_policy const &policy = retry_policy());
+    bool autocommit() const;
+    sqlite3_int64 changes() const;
+    sqlite3_int64 last_insert_rowid() const;
     std::shared_ptr<statement> prepare(std::string const&);
+    std::shared_ptr<statement> prepare_cached(std::string const&);
+    std::shared_ptr<statement> try_prepare(
+            std::string const&,
+            std::error_code &ec);
+    void set_statement_cache_size(std::size_t);
+
+    // Database image as sqlite3_serialize sees it, i.e. decrypted pages.
+    // serialize() always copies. serialize_view() borrows the memory of an
+    // in-memory (deserialized) database without copying; it stays valid
+    // until the next write or deserialize, and is empty when the schema is
+    // not stored contiguously in memory.
+    std::vector<unsigned char> serialize(std::string const &schema = "main");
+    blob_view serialize_view(std::string const &schema = "main");
+    // Replaces schema with a copy of image, held in memory from now on.
+    // Typically used on a ":memory:" connection to serve a read-mostly
+    // dataset without page cache misses or per-read decryption. A
+    // read-write image grows as needed.
+    void deserialize(
+            blob_view const &image,
+            bool readonly,
+            std::string const &schema = "main");
 
     static int is_threadsafe();
+    // quotes an identifier (table, column, savepoint) for use in SQL text
+    static std::string quote(std::string const &identifier);
     void lock();
     void unlock();
     bool try_lock();
@@ -100,17 +382,240 @@ public:
     int limit(int category);
     int limit(int category, int value);
     void set_extended_errcode(bool);
+    // a NULL policy removes the busy handler, so BUSY is returned at once
+    void set_busy_policy(std::shared_ptr<busy_policy> const&);
+    std::shared_ptr<busy_policy> get_busy_policy() const;
+    void set_busy_timeout(int ms);
+
+    // Called after every commit in WAL mode with the schema name and the
+    // number of frames now in its WAL, on the committing thread. Installing
+    // a hook turns auto-checkpoint off; an empty one removes it without
+    // turning it back on (see wal_autocheckpoint()).
+    typedef std::function<void(char const*, int)> wal_hook;
+    void set_wal_hook(wal_hook const&);
+    void wal_autocheckpoint(int frames);
+    // mode is one of SQLITE_CHECKPOINT_*. Returns false when the checkpoint
+    // could not finish because of other connections (SQLITE_BUSY); frames
+    // and checkpointed are filled in either way.
+    bool checkpoint(
+            int mode,
+            int &frames,
+            int &checkpointed,
+            std::string const &schema = "main");
 
     void throws(int ecode, std::string const &message);
 protected:
+    void apply_cipher_profile();
+
     std::shared_ptr<mutex> get_mutex();
 private:
+    class statement_cache;
+
     sqlite3 *_M_db;
+    std::shared_ptr<statement_cache> _M_cache;
+    std::shared_ptr<busy_policy> _M_busy;
+    std::atomic<unsigned> _M_savepoints;
+    cipher_profile _M_profile;
+    bool _M_has_profile;
+    int _M_flags;
+    std::string _M_vfs;
+    wal_hook _M_wal_hook;
 
     sqlcipherxx(sqlcipherxx const&);
     sqlcipherxx& operator=(sqlcipherxx const&);
 };
 
+template <typename T>
+struct value_traits<T,
+    typename std::enable_if<std::is_integral<T>::value>::type> {
+    static void bind(sqlcipherxx::statement &s, int i, T value) {
+        s.set_int64(i, static_cast<sqlite3_int64>(value));
+    }
+    static T get(sqlcipherxx::statement &s, int i) {
+        return static_cast<T>(s.get_int64(i));
+    }
+};
+
+template <typename T>
+struct value_traits<T,
+    typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static void bind(sqlcipherxx::statement &s, int i, T value) {
+        s.set_double(i, static_cast<double>(value));
+    }
+    static T get(sqlcipherxx::statement &s, int i) {
+        return static_cast<T>(s.get_double(i));
+    }
+};
+
+template <>
+struct value_traits<std::string> {
+    static void bind(sqlcipherxx::statement &s, int i, std::string const &value) {
+        s.set_string(i, value);
+    }
+    static std::string get(sqlcipherxx::statement &s, int i) {
+        return std::string(s.get_view(i));
+    }
+};
+
+template <>
+struct value_traits<std::string_view> {
+    static void bind(sqlcipherxx::statement &s, int i, std::string_view value) {
+        s.set_view(i, value);
+    }
+    static std::string_view get(sqlcipherxx::statement &s, int i) {
+        return s.get_view(i);
+    }
+};
+
+template <>
+struct value_traits<char const*> {
+    static void bind(sqlcipherxx::statement &s, int i, char const *value) {
+        if (value)
+            s.set_view(i, value);
+        else
+            s.set_null(i);
+    }
+};
+
+template <>
+struct value_traits<char*> : value_traits<char const*> {
+};
+
+template <>
+struct value_traits<sqlcipherxx::blob_view> {
+    static void bind(
+            sqlcipherxx::statement &s,
+            int i,
+            sqlcipherxx::blob_view const &value) {
+        s.set_blob(i, value);
+    }
+    static sqlcipherxx::blob_view get(sqlcipherxx::statement &s, int i) {
+        return s.get_blob(i);
+    }
+};
+
+template <>
+struct value_traits<std::vector<unsigned char> > {
+    static void bind(
+            sqlcipherxx::statement &s,
+            int i,
+            std::vector<unsigned char> const &value) {
+        s.set_blob(i, sqlcipherxx::blob_view(value.data(), value.size()));
+    }
+    static std::vector<unsigned char> get(sqlcipherxx::statement &s, int i) {
+        sqlcipherxx::blob_view blob = s.get_blob(i);
+        return std::vector<unsigned char>(blob.begin(), blob.end());
+    }
+};
+
+template <>
+struct value_traits<std::nullptr_t> {
+    static void bind(sqlcipherxx::statement &s, int i, std::nullptr_t) {
+        s.set_null(i);
+    }
+};
+
+/**
+ * Input range over the remaining rows of a statement, each decoded into a
+ * std::tuple<Ts...> from columns 0..sizeof...(Ts)-1. The column count is
+ * checked once when the range is created. Views in a row are only valid
+ * until the range is advanced.
+ */
+template <typename... Ts>
+class row_range {
+    public:
+        typedef std::tuple<Ts...> value_type;
+
+        class iterator {
+            public:
+                typedef std::input_iterator_tag iterator_category;
+                typedef std::tuple<Ts...> value_type;
+                typedef std::ptrdiff_t difference_type;
+                typedef value_type const* pointer;
+                typedef value_type reference;
+
+                iterator() : _M_stmt(NULL) {}
+
+                reference operator*() const {
+                    return decode(std::index_sequence_for<Ts...>());
+                }
+
+                iterator& operator++() {
+                    if (!_M_stmt->next())
+                        _M_stmt = NULL;
+                    return *this;
+                }
+
+                void operator++(int) {
+                    ++*this;
+                }
+
+                bool operator==(iterator const &other) const {
+                    return _M_stmt == other._M_stmt;
+                }
+
+                bool operator!=(iterator const &other) const {
+                    return _M_stmt != other._M_stmt;
+                }
+            private:
+                explicit iterator(sqlcipherxx::statement *stmt)
+                    : _M_stmt(stmt)
+                {
+                    ++*this;
+                }
+
+                template <std::size_t... I>
+                value_type decode(std::index_sequence<I...>) const {
+                    return value_type(
+                            value_traits<Ts>::get(*_M_stmt, I)...);
+                }
+
+                sqlcipherxx::statement *_M_stmt;
+                friend class row_range;
+        };
+
+        explicit row_range(sqlcipherxx::statement &stmt)
+            : _M_stmt(stmt)
+        {
+            if (_M_stmt.ncols() < static_cast<int>(sizeof...(Ts)))
+                throw std::runtime_error("row_range: too few result columns");
+        }
+
+        iterator begin() {
+            return iterator(&_M_stmt);
+        }
+
+        iterator end() {
+            return iterator();
+        }
+    private:
+        sqlcipherxx::statement &_M_stmt;
+};
+
+template <typename T>
+inline void sqlcipherxx::statement::bind(int icol, T const &value) {
+    value_traits<typename std::decay<T>::type>::bind(*this, icol, value);
+}
+
+template <typename T>
+inline T sqlcipherxx::statement::get(int icol) {
+    return value_traits<T>::get(*this, icol);
+}
+
+template <typename... Args>
+inline void sqlcipherxx::statement::bind_all(Args const&... args) {
+    if (nparams() != static_cast<int>(sizeof...(Args)))
+        throw std::runtime_error("bind_all: parameter count mismatch");
+    int iparam = 0;
+    (void) iparam;
+    (bind(++iparam, args), ...);
+}
+
+template <typename... Ts>
+inline row_range<Ts...> sqlcipherxx::statement::rows() {
+    return row_range<Ts...>(*this);
+}
+
 }
 
 #endif // SQLCIPHERXX_HPP_INCLUDED
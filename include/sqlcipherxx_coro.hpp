@@ -0,0 +1,277 @@
+#ifndef SQLCIPHERXX_CORO_HPP_INCLUDED
+#define SQLCIPHERXX_CORO_HPP_INCLUDED
+
+/**
+ * C++20 coroutine adapters. Every awaitable hands its blocking SQLite call
+ * to a thread_pool worker and resumes the awaiting coroutine on that worker
+ * once the call returns, so an in-flight query holds no thread while it
+ * waits for one.
+ *
+ *   org::task<std::int64_t> count(org::async_db &db) {
+ *       org::async_db::result_set rs =
+ *           co_await org::query(db, "SELECT COUNT(*) FROM t");
+ *       co_return std::get<sqlite3_int64>(rs.rows[0][0]);
+ *   }
+ *   std::future<std::int64_t> n = org::spawn(count(db));
+ *
+ * A statement and its connection are not thread-safe: do not touch them
+ * from elsewhere while a next_async()/execute_async() on them is pending.
+ *
+ * Empty unless the compiler has coroutine support.
+ */
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "async_db.hpp"
+#include "sqlcipherxx.hpp"
+#include "thread_pool.hpp"
+
+namespace org {
+
+// runs fn on a pool worker, resuming the awaiter there with its result
+template <typename F>
+class blocking_awaitable {
+public:
+    typedef std::invoke_result_t<F> result_type;
+
+    blocking_awaitable(thread_pool &pool, F fn)
+        : _M_pool(pool)
+        , _M_fn(std::move(fn))
+    {
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        _M_pool.post([this, h] {
+            try {
+                if constexpr (std::is_void_v<result_type>) {
+                    _M_fn();
+                    _M_result.template emplace<1>();
+                } else {
+                    _M_result.template emplace<1>(_M_fn());
+                }
+            } catch (...) {
+                _M_result.template emplace<2>(std::current_exception());
+            }
+            h.resume();
+        });
+    }
+
+    result_type await_resume() {
+        if (_M_result.index() == 2)
+            std::rethrow_exception(std::get<2>(_M_result));
+        if constexpr (!std::is_void_v<result_type>)
+            return std::move(std::get<1>(_M_result));
+    }
+private:
+    typedef std::conditional_t<
+        std::is_void_v<result_type>, std::monostate, result_type> value_type;
+
+    thread_pool &_M_pool;
+    F _M_fn;
+    std::variant<std::monostate, value_type, std::exception_ptr> _M_result;
+};
+
+template <typename F>
+blocking_awaitable<F> run_on(thread_pool &pool, F fn) {
+    return blocking_awaitable<F>(pool, std::move(fn));
+}
+
+inline auto next_async(thread_pool &pool, sqlcipherxx::statement &stmt) {
+    return run_on(pool, [&stmt] { return stmt.next(); });
+}
+
+inline auto execute_async(thread_pool &pool, sqlcipherxx::statement &stmt) {
+    return run_on(pool, [&stmt] { return stmt.execute(); });
+}
+
+// async_db::submit(sql, params) without blocking on the future
+inline auto query(
+        async_db &db,
+        std::string sql,
+        std::vector<async_db::value> params = std::vector<async_db::value>()) {
+    sqlcipherxx_pool *connections = &db.connections();
+    return run_on(db.threads(),
+            [connections, sql = std::move(sql), params = std::move(params)] {
+                std::shared_ptr<sqlcipherxx_pool::lease> l =
+                    connections->acquire();
+                return async_db::collect(l->get(), sql, params);
+            });
+}
+
+// runs fn(sqlcipherxx&) with a connection leased from db
+template <typename F>
+auto with_connection(async_db &db, F fn) {
+    sqlcipherxx_pool *connections = &db.connections();
+    return run_on(db.threads(), [connections, fn = std::move(fn)] () mutable {
+        std::shared_ptr<sqlcipherxx_pool::lease> l = connections->acquire();
+        return fn(l->get());
+    });
+}
+
+/**
+ * Minimal lazily started coroutine: runs when first awaited, then resumes
+ * its awaiter from wherever it finished. Start a top-level one with
+ * spawn().
+ */
+template <typename T>
+class task {
+public:
+    struct promise_type;
+    typedef std::coroutine_handle<promise_type> handle;
+
+    struct final_awaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+        std::coroutine_handle<> await_suspend(handle h) noexcept {
+            std::coroutine_handle<> next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() const noexcept {
+        }
+    };
+
+    struct promise_base {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+
+        std::suspend_always initial_suspend() const noexcept {
+            return std::suspend_always();
+        }
+        final_awaiter final_suspend() const noexcept {
+            return final_awaiter();
+        }
+        void unhandled_exception() {
+            error = std::current_exception();
+        }
+    };
+
+    struct value_promise : promise_base {
+        std::variant<std::monostate, T> value;
+
+        void return_value(T v) {
+            value.template emplace<1>(std::move(v));
+        }
+        T result() {
+            if (this->error)
+                std::rethrow_exception(this->error);
+            return std::move(std::get<1>(value));
+        }
+    };
+
+    struct void_promise : promise_base {
+        void return_void() {
+        }
+        void result() {
+            if (this->error)
+                std::rethrow_exception(this->error);
+        }
+    };
+
+    struct promise_type
+        : std::conditional_t<std::is_void_v<T>, void_promise, value_promise> {
+        task get_return_object() {
+            return task(handle::from_promise(*this));
+        }
+    };
+
+    task(task &&other) noexcept
+        : _M_h(std::exchange(other._M_h, handle()))
+    {
+    }
+
+    ~task() {
+        if (_M_h)
+            _M_h.destroy();
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+        _M_h.promise().continuation = awaiter;
+        return _M_h;
+    }
+
+    T await_resume() {
+        return _M_h.promise().result();
+    }
+private:
+    explicit task(handle h)
+        : _M_h(h)
+    {
+    }
+
+    handle _M_h;
+
+    task(task const&);
+    task& operator=(task const&);
+};
+
+namespace detail {
+
+// fire-and-forget frame that frees itself when done
+struct detached {
+    struct promise_type {
+        detached get_return_object() noexcept {
+            return detached();
+        }
+        std::suspend_never initial_suspend() const noexcept {
+            return std::suspend_never();
+        }
+        std::suspend_never final_suspend() const noexcept {
+            return std::suspend_never();
+        }
+        void return_void() noexcept {
+        }
+        void unhandled_exception() noexcept {
+            std::terminate();
+        }
+    };
+};
+
+template <typename T>
+detached complete(task<T> t, std::promise<T> p) {
+    try {
+        if constexpr (std::is_void_v<T>) {
+            co_await t;
+            p.set_value();
+        } else {
+            p.set_value(co_await t);
+        }
+    } catch (...) {
+        p.set_exception(std::current_exception());
+    }
+}
+
+}
+
+// starts t on the calling thread; the future is ready once it finishes
+template <typename T>
+std::future<T> spawn(task<T> t) {
+    std::promise<T> p;
+    std::future<T> f = p.get_future();
+    detail::complete(std::move(t), std::move(p));
+    return f;
+}
+
+}
+
+#endif // __cpp_impl_coroutine
+
+#endif // SQLCIPHERXX_CORO_HPP_INCLUDED
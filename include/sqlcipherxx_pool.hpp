@@ -0,0 +1,84 @@
+#ifndef SQLCIPHERXX_POOL_HPP_INCLUDED
+#define SQLCIPHERXX_POOL_HPP_INCLUDED
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sqlcipherxx.hpp"
+
+namespace org {
+
+/**
+ * A fixed set of connections to one database file, opened (and keyed by the
+ * initializer) once and handed out to threads through RAII leases.
+ *
+ * A thread gets back the connection it used last whenever that one is idle,
+ * so its page cache and prepared statements stay warm.
+ */
+class sqlcipherxx_pool {
+public:
+    typedef std::function<void(sqlcipherxx&)> initializer;
+
+    class lease {
+        public:
+            virtual ~lease();
+
+            sqlcipherxx& operator*() const;
+            sqlcipherxx* operator->() const;
+            sqlcipherxx& get() const;
+        protected:
+            lease(sqlcipherxx_pool&, std::size_t);
+        private:
+            sqlcipherxx_pool &_M_pool;
+            std::size_t _M_slot;
+
+            lease(lease const&);
+            lease& operator=(lease const&);
+            friend class sqlcipherxx_pool;
+    };
+
+    sqlcipherxx_pool(
+            std::string const &filename,
+            std::size_t size,
+            initializer const &init = initializer(),
+            int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+            std::string const &vfs = "");
+    virtual ~sqlcipherxx_pool();
+
+    std::shared_ptr<lease> acquire();
+    std::shared_ptr<lease> try_acquire(std::chrono::milliseconds timeout);
+
+    std::size_t size() const;
+    std::size_t idle() const;
+    std::string filename() const;
+private:
+    struct slot {
+        std::unique_ptr<sqlcipherxx> connection;
+        std::thread::id owner;
+        bool busy;
+    };
+
+    std::size_t pick(std::thread::id const &self) const;
+    std::shared_ptr<lease> take(std::size_t, std::thread::id const&);
+    void release(std::size_t);
+
+    std::string _M_filename;
+    std::vector<slot> _M_slots;
+    std::size_t _M_idle;
+    mutable std::mutex _M_mutex;
+    std::condition_variable _M_cond;
+
+    sqlcipherxx_pool(sqlcipherxx_pool const&);
+    sqlcipherxx_pool& operator=(sqlcipherxx_pool const&);
+};
+
+}
+
+#endif // SQLCIPHERXX_POOL_HPP_INCLUDED
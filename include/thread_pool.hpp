@@ -0,0 +1,62 @@
+#ifndef THREAD_POOL_HPP_INCLUDED
+#define THREAD_POOL_HPP_INCLUDED
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace org {
+
+/**
+ * Fixed number of worker threads taking tasks from one FIFO queue. The
+ * destructor runs whatever is still queued before joining the workers.
+ */
+class thread_pool {
+public:
+    typedef std::function<void()> task;
+
+    explicit thread_pool(std::size_t nthreads);
+    virtual ~thread_pool();
+
+    // exceptions escaping a posted task are swallowed
+    void post(task const &fn);
+
+    // runs fn on a worker, its result or exception lands in the future
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F fn);
+
+    std::size_t size() const;
+private:
+    void run();
+
+    std::deque<task> _M_queue;
+    bool _M_stopping;
+    std::mutex _M_mutex;
+    std::condition_variable _M_cond;
+    std::vector<std::thread> _M_threads;
+
+    thread_pool(thread_pool const&);
+    thread_pool& operator=(thread_pool const&);
+};
+
+template <typename F>
+std::future<std::invoke_result_t<F>> thread_pool::submit(F fn) {
+    typedef std::invoke_result_t<F> result_type;
+    // std::function needs a copyable target, packaged_task is move-only
+    std::shared_ptr<std::packaged_task<result_type()>> t(
+            new std::packaged_task<result_type()>(std::move(fn)));
+    std::future<result_type> result = t->get_future();
+    post([t] { (*t)(); });
+    return result;
+}
+
+}
+
+#endif // THREAD_POOL_HPP_INCLUDED
@@ -0,0 +1,87 @@
+#ifndef WAL_ROUTER_HPP_INCLUDED
+#define WAL_ROUTER_HPP_INCLUDED
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "sqlcipherxx.hpp"
+#include "sqlcipherxx_pool.hpp"
+
+namespace org {
+
+/**
+ * Single-writer / multi-reader access to a WAL database. One read-write
+ * connection is shared by all writers, who queue for it, so writers never
+ * see SQLITE_BUSY from each other; reads spread over a pool of
+ * SQLITE_OPEN_READONLY connections.
+ *
+ * prepare() sends SELECT, VALUES and read-only WITH statements to a reader
+ * and everything else to the writer, and keeps the connection leased for as
+ * long as the returned statement lives, so do not hold two statements of
+ * the same kind on one thread when the pool is that small. Run explicit
+ * transactions through write() instead.
+ */
+class wal_router {
+public:
+    typedef sqlcipherxx_pool::initializer initializer;
+
+    // A snapshot plus the reader that took it, which stays leased with its
+    // read transaction open until the handle goes away, so no checkpoint
+    // can move the WAL past the snapshot meanwhile. Each live handle takes
+    // one connection out of the reader pool.
+    class snapshot_handle {
+        public:
+            virtual ~snapshot_handle();
+            sqlcipherxx::snapshot const& get() const;
+        protected:
+            snapshot_handle(
+                    std::shared_ptr<sqlcipherxx_pool::lease> const&,
+                    std::shared_ptr<sqlcipherxx::transaction> const&,
+                    std::shared_ptr<sqlcipherxx::snapshot> const&);
+        private:
+            std::shared_ptr<sqlcipherxx_pool::lease> _M_reader;
+            std::shared_ptr<sqlcipherxx::transaction> _M_tran;
+            std::shared_ptr<sqlcipherxx::snapshot> _M_snapshot;
+
+            snapshot_handle(snapshot_handle const&);
+            snapshot_handle& operator=(snapshot_handle const&);
+            friend class wal_router;
+    };
+
+    wal_router(
+            std::string const &filename,
+            std::size_t nreaders,
+            initializer const &init = initializer(),
+            std::string const &vfs = "");
+    virtual ~wal_router();
+
+    std::shared_ptr<sqlcipherxx::statement> prepare(std::string const &sql);
+
+    // runs fn on the writer inside BEGIN IMMEDIATE, see run_in_transaction()
+    int write(
+            std::function<void(sqlcipherxx&)> const &fn,
+            sqlcipherxx::retry_policy const &retry = sqlcipherxx::retry_policy());
+    void read(std::function<void(sqlcipherxx&)> const &fn);
+    // runs fn on a reader inside a read transaction on snap, so fan-out
+    // jobs on several readers all see the same committed state
+    void read(
+            sqlcipherxx::snapshot const &snap,
+            std::function<void(sqlcipherxx&)> const &fn);
+    // the latest committed state, as seen by a reader; see snapshot_handle
+    std::shared_ptr<snapshot_handle> snapshot();
+
+    sqlcipherxx_pool& writer();
+    sqlcipherxx_pool& readers();
+private:
+    sqlcipherxx_pool _M_writer;
+    sqlcipherxx_pool _M_readers;
+
+    wal_router(wal_router const&);
+    wal_router& operator=(wal_router const&);
+};
+
+}
+
+#endif // WAL_ROUTER_HPP_INCLUDED
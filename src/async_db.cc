@@ -0,0 +1,108 @@
+#include <stdexcept>
+#include <utility>
+
+#include "async_db.hpp"
+
+namespace {
+typedef org::async_db::value value;
+
+struct binder {
+    org::sqlcipherxx::statement &stmt;
+    int icol;
+
+    void operator()(std::nullptr_t) const {
+        stmt.set_null(icol);
+    }
+    void operator()(sqlite3_int64 v) const {
+        stmt.set_int64(icol, v);
+    }
+    void operator()(double v) const {
+        stmt.set_double(icol, v);
+    }
+    void operator()(std::string const &v) const {
+        stmt.set_view(icol, v);
+    }
+    void operator()(std::vector<unsigned char> const &v) const {
+        stmt.set_blob(icol, org::sqlcipherxx::blob_view(v.data(), v.size()));
+    }
+};
+
+value column(org::sqlcipherxx::statement &stmt, int icol) {
+    switch (stmt.coltype(icol)) {
+        case SQLITE_INTEGER:
+            return stmt.get_int64(icol);
+        case SQLITE_FLOAT:
+            return stmt.get_double(icol);
+        case SQLITE_TEXT:
+            return stmt.get_string(icol);
+        case SQLITE_BLOB: {
+            org::sqlcipherxx::blob_view b = stmt.get_blob(icol);
+            return std::vector<unsigned char>(b.begin(), b.end());
+        }
+        default:
+            return nullptr;
+    }
+}
+}
+
+namespace org {
+
+async_db::async_db(
+        std::string const &filename,
+        std::size_t nthreads,
+        initializer const &init,
+        int flags,
+        std::string const &vfs)
+    : _M_connections(filename, nthreads, init, flags, vfs)
+    , _M_threads(nthreads)
+{
+}
+
+async_db::~async_db() {
+}
+
+std::future<async_db::result_set> async_db::submit(
+        std::string const &sql,
+        std::vector<value> const &params) {
+    return submit([sql, params] (sqlcipherxx &db) {
+        return collect(db, sql, params);
+    });
+}
+
+async_db::result_set async_db::collect(
+        sqlcipherxx &db,
+        std::string const &sql,
+        std::vector<value> const &params) {
+    std::shared_ptr<sqlcipherxx::statement> stmt = db.prepare_cached(sql);
+    if (static_cast<int>(params.size()) != stmt->nparams())
+        throw std::invalid_argument("async_db: wrong number of parameters");
+    // params outlives the statement's use, so binding by view is fine
+    for (std::size_t i = 0; i < params.size(); ++i)
+        std::visit(binder{*stmt, static_cast<int>(i + 1)}, params[i]);
+
+    result_set rs;
+    int ncols = stmt->ncols();
+    rs.columns.reserve(ncols);
+    for (int i = 0; i < ncols; ++i)
+        rs.columns.push_back(stmt->colname(i));
+    while (stmt->next()) {
+        std::vector<value> row;
+        row.reserve(ncols);
+        for (int i = 0; i < ncols; ++i)
+            row.push_back(column(*stmt, i));
+        rs.rows.push_back(std::move(row));
+    }
+    rs.changes = db.changes();
+    rs.last_insert_rowid = db.last_insert_rowid();
+    return rs;
+}
+
+sqlcipherxx_pool& async_db::connections() {
+    return _M_connections;
+}
+
+thread_pool& async_db::threads() {
+    return _M_threads;
+}
+
+}  // namespace org
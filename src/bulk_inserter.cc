@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "bulk_inserter.hpp"
+
+namespace org {
+
+bulk_inserter::bulk_inserter(
+        sqlcipherxx &db,
+        std::string const &table,
+        std::vector<std::string> const &columns,
+        std::size_t batch_size)
+    : _M_db(db)
+    , _M_ncols(columns.size())
+    , _M_batch_size(batch_size)
+    , _M_rows_per_stmt(0)
+    , _M_pending(0)
+    , _M_uncommitted(0)
+    , _M_inserted(0)
+{
+    if (columns.empty())
+        throw std::invalid_argument("bulk_inserter: no columns");
+    if (batch_size == 0)
+        throw std::invalid_argument("bulk_inserter: batch size must be positive");
+    std::size_t nvars = _M_db.limit(SQLITE_LIMIT_VARIABLE_NUMBER);
+    _M_rows_per_stmt = std::min(nvars / _M_ncols, _M_batch_size);
+    if (_M_rows_per_stmt == 0)
+        throw std::invalid_argument(
+                "bulk_inserter: more columns than SQLITE_LIMIT_VARIABLE_NUMBER");
+
+    std::ostringstream prefix;
+    prefix << "INSERT INTO " << sqlcipherxx::quote(table) << "(";
+    for (std::size_t i = 0; i < _M_ncols; ++i)
+        prefix << (i ? ", " : "") << sqlcipherxx::quote(columns[i]);
+    prefix << ") VALUES ";
+    _M_prefix = prefix.str();
+
+    _M_cells.resize(_M_rows_per_stmt * _M_ncols);
+    _M_stmt = _M_db.prepare(values_sql(_M_rows_per_stmt));
+}
+
+bulk_inserter::~bulk_inserter() {
+    try {
+        flush();
+    } catch (...) {
+        // flush() has rolled the batch back
+    }
+}
+
+void bulk_inserter::flush() {
+    try {
+        write();
+        if (_M_tran) {
+            _M_tran->commit();
+            _M_tran.reset();
+        }
+        if (_M_savepoint) {
+            _M_savepoint->release();
+            _M_savepoint.reset();
+        }
+    } catch (...) {
+        rollback();
+        throw;
+    }
+    _M_inserted += _M_uncommitted;
+    _M_uncommitted = 0;
+}
+
+void bulk_inserter::rollback() {
+    _M_pending = 0;
+    _M_uncommitted = 0;
+    std::shared_ptr<sqlcipherxx::transaction> tran;
+    tran.swap(_M_tran);
+    if (tran)
+        tran->abandon();
+    std::shared_ptr<sqlcipherxx::savepoint> sp;
+    sp.swap(_M_savepoint);
+    if (sp) {
+        try {
+            sp->rollback();
+        } catch (...) {
+        }
+    }
+}
+
+std::size_t bulk_inserter::rows_per_statement() const {
+    return _M_rows_per_stmt;
+}
+
+std::size_t bulk_inserter::inserted() const {
+    return _M_inserted;
+}
+
+void bulk_inserter::row_staged() {
+    if (!_M_tran && !_M_savepoint) {
+        if (_M_db.autocommit())
+            _M_tran = _M_db.begin_immediate();
+        else
+            _M_savepoint = _M_db.begin_savepoint();
+    }
+    ++_M_pending;
+    ++_M_uncommitted;
+    if (_M_pending == _M_rows_per_stmt) {
+        try {
+            write();
+        } catch (...) {
+            // a partial batch must not be committed later on
+            rollback();
+            throw;
+        }
+    }
+    if (_M_uncommitted >= _M_batch_size)
+        flush();
+}
+
+void bulk_inserter::write() {
+    if (_M_pending == 0)
+        return;
+    std::shared_ptr<sqlcipherxx::statement> stmt = _M_stmt;
+    if (_M_pending != _M_rows_per_stmt)
+        stmt = _M_db.prepare_cached(values_sql(_M_pending));
+    for (std::size_t i = 0, n = _M_pending * _M_ncols; i < n; ++i) {
+        cell const &c = _M_cells[i];
+        int iparam = static_cast<int>(i + 1);
+        switch (c.type) {
+            case SQLITE_INTEGER:
+                stmt->set_int64(iparam, c.i);
+                break;
+            case SQLITE_FLOAT:
+                stmt->set_double(iparam, c.d);
+                break;
+            case SQLITE_TEXT:
+                stmt->set_view(iparam, c.bytes);
+                break;
+            case SQLITE_BLOB:
+                stmt->set_blob(iparam, sqlcipherxx::blob_view(
+                            c.bytes.data(), c.bytes.size()));
+                break;
+            default:
+                stmt->set_null(iparam);
+                break;
+        }
+    }
+    _M_pending = 0;
+    stmt->execute();
+}
+
+std::string bulk_inserter::values_sql(std::size_t nrows) const {
+    std::string row("(?");
+    for (std::size_t i = 1; i < _M_ncols; ++i)
+        row += ",?";
+    row += ")";
+    std::string sql(_M_prefix);
+    sql.reserve(sql.size() + nrows * (row.size() + 1));
+    for (std::size_t i = 0; i < nrows; ++i) {
+        if (i)
+            sql += ",";
+        sql += row;
+    }
+    return sql;
+}
+
+}  // namespace org
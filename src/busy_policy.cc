@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <thread>
+
+#include "busy_policy.hpp"
+
+namespace org {
+
+busy_policy::options::options()
+    : timeout(5000)
+    , initial_delay(100)
+    , max_delay(50000)
+    , multiplier(2.0)
+    , jitter(0.5)
+    , max_retries(0)
+{
+}
+
+busy_policy::options busy_policy::fixed(
+        std::chrono::milliseconds timeout,
+        std::chrono::microseconds interval) {
+    options opts;
+    opts.timeout = timeout;
+    opts.initial_delay = interval;
+    opts.max_delay = interval;
+    opts.multiplier = 1.0;
+    opts.jitter = 0.0;
+    return opts;
+}
+
+busy_policy::options busy_policy::exponential(
+        std::chrono::milliseconds timeout,
+        std::chrono::microseconds initial_delay,
+        std::chrono::microseconds max_delay,
+        double jitter) {
+    options opts;
+    opts.timeout = timeout;
+    opts.initial_delay = initial_delay;
+    opts.max_delay = max_delay;
+    opts.multiplier = 2.0;
+    opts.jitter = jitter;
+    return opts;
+}
+
+busy_policy::busy_policy(options const &opts)
+    : _M_options(opts)
+    , _M_events(0)
+    , _M_waits(0)
+    , _M_gave_up(0)
+    , _M_waited_us(0)
+{
+}
+
+busy_policy::~busy_policy() {
+}
+
+bool busy_policy::wait(int count) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    using std::chrono::steady_clock;
+
+    // the handler runs on the thread stepping the statement, and one thread
+    // cannot be inside two busy events at once
+    static thread_local steady_clock::time_point started;
+    steady_clock::time_point now = steady_clock::now();
+    if (count == 0) {
+        started = now;
+        ++_M_events;
+    }
+    if (_M_options.max_retries > 0 && count >= _M_options.max_retries) {
+        ++_M_gave_up;
+        return false;
+    }
+    microseconds d = delay(count);
+    if (_M_options.timeout.count() > 0) {
+        microseconds left = duration_cast<microseconds>(
+                _M_options.timeout - (now - started));
+        if (left.count() <= 0) {
+            ++_M_gave_up;
+            return false;
+        }
+        d = std::min(d, left);
+    }
+    std::this_thread::sleep_for(d);
+    ++_M_waits;
+    _M_waited_us += duration_cast<microseconds>(
+            steady_clock::now() - now).count();
+    return true;
+}
+
+busy_policy::options const& busy_policy::get_options() const {
+    return _M_options;
+}
+
+busy_policy::statistics busy_policy::stats() const {
+    statistics s;
+    s.events = _M_events;
+    s.waits = _M_waits;
+    s.gave_up = _M_gave_up;
+    s.waited = std::chrono::microseconds(_M_waited_us);
+    return s;
+}
+
+void busy_policy::reset_stats() {
+    _M_events = 0;
+    _M_waits = 0;
+    _M_gave_up = 0;
+    _M_waited_us = 0;
+}
+
+std::chrono::microseconds busy_policy::delay(int count) const {
+    static thread_local std::minstd_rand rng(static_cast<unsigned>(
+                std::random_device()()
+                ^ std::hash<std::thread::id>()(std::this_thread::get_id())));
+    double base = static_cast<double>(_M_options.initial_delay.count())
+        * std::pow(_M_options.multiplier, count);
+    double d = std::min(base, static_cast<double>(_M_options.max_delay.count()));
+    if (_M_options.jitter > 0) {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        d = d * (1.0 - _M_options.jitter) + d * _M_options.jitter * uniform(rng);
+    }
+    return std::chrono::microseconds(static_cast<std::int64_t>(d));
+}
+
+}  // namespace org
@@ -0,0 +1,160 @@
+#include <algorithm>
+
+#include "checkpointer.hpp"
+
+namespace org {
+
+checkpointer::options::options()
+    : passive_frames(1000)
+    , restart_frames(10000)
+    , idle_time(1000)
+    , busy_timeout(100)
+{
+}
+
+checkpointer::checkpointer(
+        sqlcipherxx &db,
+        options const &opts,
+        initializer const &init)
+    : _M_options(opts)
+    , _M_db(db.db_filename())
+    , _M_frames(0)
+    , _M_backfilled(0)
+    , _M_dirty(false)
+    , _M_commits(0)
+    , _M_seen(0)
+    , _M_last_commit(std::chrono::steady_clock::now())
+    , _M_last_attempt(_M_last_commit)
+    , _M_stopping(false)
+    , _M_stats()
+{
+    if (init)
+        init(_M_db);
+    _M_db.set_busy_timeout(_M_options.busy_timeout);
+    // checkpoints are no-ops until the connection has seen the file is in
+    // WAL mode
+    _M_db.execute("PRAGMA application_id");
+    watch(db);
+    _M_thread = std::thread(&checkpointer::run, this);
+}
+
+checkpointer::~checkpointer() {
+    for (std::size_t i = 0; i < _M_watched.size(); ++i) {
+        try {
+            // SQLite's default threshold
+            _M_watched[i]->wal_autocheckpoint(1000);
+        } catch (...) {
+        }
+    }
+    {
+        std::unique_lock<std::mutex> locker(_M_mutex);
+        _M_stopping = true;
+    }
+    _M_cond.notify_all();
+    if (_M_thread.joinable())
+        _M_thread.join();
+}
+
+void checkpointer::watch(sqlcipherxx &db) {
+    db.set_wal_hook([this] (char const*, int frames) {
+        committed(frames);
+    });
+    std::unique_lock<std::mutex> locker(_M_mutex);
+    _M_watched.push_back(&db);
+}
+
+checkpointer::statistics checkpointer::stats() const {
+    std::unique_lock<std::mutex> locker(_M_mutex);
+    return _M_stats;
+}
+
+// runs on the committing thread, so only takes notes
+void checkpointer::committed(int frames) {
+    bool wake;
+    {
+        std::unique_lock<std::mutex> locker(_M_mutex);
+        // the WAL was started over by this commit
+        if (frames < _M_frames)
+            _M_backfilled = 0;
+        _M_frames = frames;
+        ++_M_commits;
+        _M_dirty = true;
+        _M_last_commit = std::chrono::steady_clock::now();
+        wake = _M_frames >= _M_options.restart_frames
+            || _M_frames - _M_backfilled >= _M_options.passive_frames;
+    }
+    if (wake)
+        _M_cond.notify_one();
+}
+
+void checkpointer::run() {
+    std::unique_lock<std::mutex> locker(_M_mutex);
+    while (!_M_stopping) {
+        // size triggers are only rechecked after new commits, so a reader
+        // holding frames back does not make us spin
+        bool fresh = _M_commits != _M_seen;
+        std::chrono::steady_clock::time_point idle_at =
+            std::max(_M_last_commit, _M_last_attempt) + _M_options.idle_time;
+        int mode = -1;
+        if (fresh && _M_frames >= _M_options.restart_frames)
+            mode = SQLITE_CHECKPOINT_RESTART;
+        else if (fresh && _M_frames - _M_backfilled >= _M_options.passive_frames)
+            mode = SQLITE_CHECKPOINT_PASSIVE;
+        else if (_M_dirty && std::chrono::steady_clock::now() >= idle_at)
+            mode = SQLITE_CHECKPOINT_TRUNCATE;
+
+        if (mode < 0) {
+            if (_M_dirty)
+                _M_cond.wait_until(locker, idle_at);
+            else
+                _M_cond.wait(locker);
+            continue;
+        }
+        _M_seen = _M_commits;
+        locker.unlock();
+        try {
+            checkpoint(mode);
+        } catch (...) {
+            // retried on the next commit or idle period
+        }
+        locker.lock();
+        _M_last_attempt = std::chrono::steady_clock::now();
+    }
+}
+
+void checkpointer::checkpoint(int mode) {
+    int frames = 0;
+    int checkpointed = 0;
+    bool done = _M_db.checkpoint(mode, frames, checkpointed);
+    if (!done && mode != SQLITE_CHECKPOINT_PASSIVE) {
+        {
+            std::unique_lock<std::mutex> locker(_M_mutex);
+            ++_M_stats.busy;
+        }
+        // readers are in the way, copy back what they allow
+        mode = SQLITE_CHECKPOINT_PASSIVE;
+        done = _M_db.checkpoint(mode, frames, checkpointed);
+    }
+
+    std::unique_lock<std::mutex> locker(_M_mutex);
+    if (!done)
+        ++_M_stats.busy;
+    else if (mode == SQLITE_CHECKPOINT_PASSIVE)
+        ++_M_stats.passive;
+    else if (mode == SQLITE_CHECKPOINT_RESTART)
+        ++_M_stats.restart;
+    else
+        ++_M_stats.truncate;
+    if (checkpointed > _M_backfilled) {
+        _M_stats.frames += checkpointed - _M_backfilled;
+        _M_backfilled = checkpointed;
+    }
+    // unless someone committed meanwhile, the next writer starts the WAL over
+    if (done && mode != SQLITE_CHECKPOINT_PASSIVE && _M_commits == _M_seen) {
+        _M_frames = _M_backfilled = 0;
+        if (mode == SQLITE_CHECKPOINT_TRUNCATE)
+            _M_dirty = false;
+    }
+}
+
+}  // namespace org
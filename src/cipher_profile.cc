@@ -0,0 +1,64 @@
+#include <sstream>
+#include <stdexcept>
+
+#include "cipher_profile.hpp"
+
+namespace org {
+
+cipher_profile::cipher_profile()
+    : page_size(4096)
+    , kdf_iter(256000)
+    , kdf_algorithm("PBKDF2_HMAC_SHA512")
+    , hmac_algorithm("HMAC_SHA512")
+    , use_hmac(true)
+    , plaintext_header_size(0)
+{
+}
+
+cipher_profile cipher_profile::compat_v4() {
+    return cipher_profile();
+}
+
+cipher_profile cipher_profile::throughput() {
+    cipher_profile p;
+    p.page_size = 16384;
+    return p;
+}
+
+cipher_profile cipher_profile::low_memory() {
+    cipher_profile p;
+    p.page_size = 1024;
+    return p;
+}
+
+cipher_profile cipher_profile::preset(std::string const &name) {
+    if (name == "compat-v4")
+        return compat_v4();
+    if (name == "throughput")
+        return throughput();
+    if (name == "low-memory")
+        return low_memory();
+    throw std::invalid_argument("unknown cipher profile: " + name);
+}
+
+std::vector<std::string> cipher_profile::pragmas(std::string const &schema) const {
+    std::string prefix("PRAGMA ");
+    if (!schema.empty())
+        prefix += schema + ".";
+    std::vector<std::string> sql;
+    std::ostringstream oss;
+    oss << prefix << "cipher_page_size = " << page_size;
+    sql.push_back(oss.str());
+    oss.str("");
+    oss << prefix << "kdf_iter = " << kdf_iter;
+    sql.push_back(oss.str());
+    sql.push_back(prefix + "cipher_kdf_algorithm = " + kdf_algorithm);
+    sql.push_back(prefix + "cipher_hmac_algorithm = " + hmac_algorithm);
+    sql.push_back(prefix + "cipher_use_hmac = " + (use_hmac ? "ON" : "OFF"));
+    oss.str("");
+    oss << prefix << "cipher_plaintext_header_size = " << plaintext_header_size;
+    sql.push_back(oss.str());
+    return sql;
+}
+
+}  // namespace org
@@ -0,0 +1,147 @@
+#include <exception>
+#include <stdexcept>
+#include <utility>
+
+#include "group_committer.hpp"
+
+namespace org {
+
+group_committer::group_committer(
+        sqlcipherxx &writer,
+        std::size_t max_batch,
+        std::chrono::microseconds linger,
+        sqlcipherxx::retry_policy const &retry)
+    : _M_db(writer)
+    , _M_max_batch(max_batch ? max_batch : 1)
+    , _M_linger(linger)
+    , _M_retry(retry)
+    , _M_stopping(false)
+    , _M_stats()
+{
+    // counted on the committer thread, read under the mutex by stats()
+    std::function<void(int, std::error_code const&)> on_retry =
+        _M_retry.on_retry;
+    _M_retry.on_retry = [this, on_retry] (int attempt, std::error_code const &ec) {
+        {
+            std::unique_lock<std::mutex> locker(_M_mutex);
+            ++_M_stats.retries;
+        }
+        if (on_retry)
+            on_retry(attempt, ec);
+    };
+    _M_thread = std::thread(&group_committer::run, this);
+}
+
+group_committer::~group_committer() {
+    {
+        std::unique_lock<std::mutex> locker(_M_mutex);
+        _M_stopping = true;
+    }
+    _M_cond.notify_all();
+    if (_M_thread.joinable())
+        _M_thread.join();
+}
+
+std::future<void> group_committer::submit(work const &fn) {
+    request r;
+    r.fn = fn;
+    std::future<void> done = r.done.get_future();
+    {
+        std::unique_lock<std::mutex> locker(_M_mutex);
+        if (_M_stopping)
+            throw std::logic_error("group_committer: stopping");
+        _M_queue.push_back(std::move(r));
+    }
+    _M_cond.notify_one();
+    return done;
+}
+
+group_committer::statistics group_committer::stats() const {
+    std::unique_lock<std::mutex> locker(_M_mutex);
+    return _M_stats;
+}
+
+void group_committer::run() {
+    std::vector<request> batch;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> locker(_M_mutex);
+            _M_cond.wait(locker, [this] {
+                return _M_stopping || !_M_queue.empty();
+            });
+            if (_M_queue.empty())
+                return;
+            if (_M_linger.count() > 0 && !_M_stopping)
+                _M_cond.wait_for(locker, _M_linger, [this] {
+                    return _M_stopping || _M_queue.size() >= _M_max_batch;
+                });
+            while (!_M_queue.empty() && batch.size() < _M_max_batch) {
+                batch.push_back(std::move(_M_queue.front()));
+                _M_queue.pop_front();
+            }
+        }
+        commit(batch);
+        batch.clear();
+    }
+}
+
+void group_committer::commit(std::vector<request> &batch) {
+    std::vector<std::exception_ptr> errors(batch.size());
+    std::shared_ptr<sqlcipherxx::transaction> tran;
+    try {
+        // only BEGIN and COMMIT are retried, a closure never runs twice
+        sqlcipherxx::run_with_retry([this, &tran] {
+            tran = _M_db.begin_immediate();
+        }, _M_retry);
+        for (std::size_t i = 0, n = batch.size(); i < n; ++i) {
+            std::shared_ptr<sqlcipherxx::savepoint> sp =
+                _M_db.begin_savepoint();
+            try {
+                batch[i].fn(_M_db);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+            // some errors (SQLITE_FULL, OR ROLLBACK, ...) make SQLite roll
+            // the whole transaction back; what the earlier closures wrote
+            // is gone and later ones would run in autocommit mode
+            if (_M_db.autocommit())
+                throw sqlite_error(
+                        make_sqlite_error(SQLITE_ABORT),
+                        "group_committer: transaction rolled back");
+            if (errors[i])
+                sp->rollback();
+            else
+                sp->release();
+        }
+        sqlcipherxx::run_with_retry([&tran] {
+            tran->commit();
+        }, _M_retry);
+    } catch (...) {
+        if (tran)
+            tran->abandon();
+        std::exception_ptr e = std::current_exception();
+        for (std::size_t i = 0, n = batch.size(); i < n; ++i)
+            if (!errors[i])
+                errors[i] = e;
+    }
+
+    // publish the counters before any caller can observe its future
+    std::size_t failed = 0;
+    for (std::size_t i = 0, n = batch.size(); i < n; ++i)
+        if (errors[i])
+            ++failed;
+    {
+        std::unique_lock<std::mutex> locker(_M_mutex);
+        ++_M_stats.batches;
+        _M_stats.writes += batch.size();
+        _M_stats.failed += failed;
+    }
+    for (std::size_t i = 0, n = batch.size(); i < n; ++i) {
+        if (errors[i])
+            batch[i].done.set_exception(errors[i]);
+        else
+            batch[i].done.set_value();
+    }
+}
+
+}  // namespace org
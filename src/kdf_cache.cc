@@ -0,0 +1,95 @@
+#include <stdexcept>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include "kdf_cache.hpp"
+
+namespace {
+EVP_MD const* digest(std::string const &algorithm) {
+    if (algorithm == "PBKDF2_HMAC_SHA512")
+        return EVP_sha512();
+    if (algorithm == "PBKDF2_HMAC_SHA256")
+        return EVP_sha256();
+    if (algorithm == "PBKDF2_HMAC_SHA1")
+        return EVP_sha1();
+    throw std::invalid_argument("unsupported kdf algorithm: " + algorithm);
+}
+}
+
+namespace org {
+
+kdf_cache::kdf_cache() {
+}
+
+kdf_cache::~kdf_cache() {
+    clear();
+}
+
+kdf_cache* kdf_cache::instance() {
+    static kdf_cache cache;
+    return &cache;
+}
+
+kdf_cache::bytes kdf_cache::derive(
+        std::string const &passphrase,
+        bytes const &salt,
+        int iterations,
+        std::string const &algorithm,
+        std::size_t key_size) {
+    EVP_MD const *md = digest(algorithm);
+
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<unsigned char const*>(passphrase.data()),
+            passphrase.size(), hash);
+    std::string id(reinterpret_cast<char const*>(hash), sizeof(hash));
+    OPENSSL_cleanse(hash, sizeof(hash));
+    id.append(salt.begin(), salt.end());
+    id += ':' + std::to_string(iterations) + ':' + algorithm
+        + ':' + std::to_string(key_size);
+
+    {
+        std::unique_lock<std::mutex> locker(_M_mutex);
+        std::map<std::string, bytes>::const_iterator it = _M_keys.find(id);
+        if (it != _M_keys.end())
+            return it->second;
+    }
+
+    // derived outside the lock, two threads may race to fill the same entry
+    bytes key(key_size);
+    if (!PKCS5_PBKDF2_HMAC(
+                passphrase.data(), static_cast<int>(passphrase.size()),
+                salt.data(), static_cast<int>(salt.size()),
+                iterations,
+                md,
+                static_cast<int>(key.size()), key.data()))
+        throw std::runtime_error("PKCS5_PBKDF2_HMAC");
+
+    std::unique_lock<std::mutex> locker(_M_mutex);
+    _M_keys[id] = key;
+    return key;
+}
+
+std::size_t kdf_cache::size() const {
+    std::unique_lock<std::mutex> locker(_M_mutex);
+    return _M_keys.size();
+}
+
+void kdf_cache::clear() {
+    std::unique_lock<std::mutex> locker(_M_mutex);
+    for (std::map<std::string, bytes>::iterator it = _M_keys.begin();
+            it != _M_keys.end(); ++it)
+        OPENSSL_cleanse(it->second.data(), it->second.size());
+    _M_keys.clear();
+}
+
+kdf_cache::bytes kdf_cache::random_bytes(std::size_t n) {
+    bytes b(n);
+    if (RAND_bytes(b.data(), static_cast<int>(n)) != 1)
+        throw std::runtime_error("RAND_bytes");
+    return b;
+}
+
+}  // namespace org
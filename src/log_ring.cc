@@ -0,0 +1,65 @@
+#include <cstdint>
+#include <stdexcept>
+
+#include "log_ring.hpp"
+
+namespace org {
+
+log_ring::log_ring(std::size_t capacity)
+    : _M_mask(0)
+    , _M_tail(0)
+    , _M_head(0)
+{
+    if (capacity < 2)
+        capacity = 2;
+    std::size_t n = 1;
+    while (n < capacity)
+        n <<= 1;
+    _M_cells.reset(new cell[n]);
+    _M_mask = n - 1;
+    for (std::size_t i = 0; i < n; ++i)
+        _M_cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+log_ring::~log_ring() {
+}
+
+bool log_ring::push(char const *data, std::size_t size) {
+    std::size_t tail = _M_tail.load(std::memory_order_relaxed);
+    cell *c;
+    for (;;) {
+        c = &_M_cells[tail & _M_mask];
+        std::size_t seq = c->sequence.load(std::memory_order_acquire);
+        std::intptr_t diff =
+            static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(tail);
+        if (diff == 0) {
+            // the cell is free, claim it
+            if (_M_tail.compare_exchange_weak(
+                        tail, tail + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // the consumer is a lap behind
+            return false;
+        } else {
+            // another producer claimed it first
+            tail = _M_tail.load(std::memory_order_relaxed);
+        }
+    }
+    c->data.assign(data, size);
+    c->sequence.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+std::size_t log_ring::capacity() const {
+    return _M_mask + 1;
+}
+
+std::size_t log_ring::pushed() const {
+    return _M_tail.load(std::memory_order_acquire);
+}
+
+std::size_t log_ring::popped() const {
+    return _M_head.load(std::memory_order_acquire);
+}
+
+}  // namespace org
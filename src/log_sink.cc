@@ -0,0 +1,154 @@
+#include <sstream>
+
+#include "log_sink.hpp"
+
+namespace org {
+
+log_sink::~log_sink() {
+}
+
+ostream_sink::ostream_sink(std::ostream *stream, std::mutex *mutex)
+    : _M_stream(stream)
+    , _M_mutex(mutex)
+{
+}
+
+ostream_sink::~ostream_sink() {
+}
+
+void ostream_sink::write(char const *data, std::size_t size) {
+    if (!_M_stream)
+        return;
+    std::ostream &out = *_M_stream;
+    if (!_M_mutex) {
+        out.write(data, size).flush();
+        return;
+    }
+    std::unique_lock<std::mutex> locker(*_M_mutex);
+    out.write(data, size).flush();
+}
+
+void ostream_sink::flush() {
+    if (!_M_stream)
+        return;
+    if (!_M_mutex) {
+        _M_stream->flush();
+        return;
+    }
+    std::unique_lock<std::mutex> locker(*_M_mutex);
+    _M_stream->flush();
+}
+
+std::ostream* ostream_sink::stream() const {
+    return _M_stream;
+}
+
+async_sink::options::options()
+    : capacity(8192)
+    , overflow(block)
+    , batch_size(256)
+    , idle_wait(100)
+{
+}
+
+async_sink::async_sink(std::ostream *stream, options const &opts)
+    : _M_stream(stream)
+    , _M_options(opts)
+    , _M_ring(opts.capacity)
+    , _M_dropped(0)
+    , _M_sleeping(false)
+    , _M_stopping(false)
+    , _M_flushed(0)
+{
+    if (_M_options.batch_size == 0)
+        _M_options.batch_size = 1;
+    _M_thread = std::thread(&async_sink::run, this);
+}
+
+async_sink::~async_sink() {
+    _M_stopping.store(true);
+    {
+        std::unique_lock<std::mutex> locker(_M_mutex);
+        _M_wakeup.notify_one();
+    }
+    if (_M_thread.joinable())
+        _M_thread.join();
+}
+
+void async_sink::write(char const *data, std::size_t size) {
+    while (!_M_ring.push(data, size)) {
+        if (_M_options.overflow != block) {
+            _M_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        wake();
+        std::this_thread::yield();
+    }
+    // only pay for a notification when the writer is actually asleep
+    if (_M_sleeping.load(std::memory_order_relaxed))
+        wake();
+}
+
+void async_sink::flush() {
+    std::size_t target = _M_ring.pushed();
+    std::unique_lock<std::mutex> locker(_M_mutex);
+    _M_wakeup.notify_one();
+    _M_flushed_cond.wait(locker, [this, target] {
+        return _M_flushed >= target || _M_stopping.load();
+    });
+}
+
+std::uint64_t async_sink::dropped() const {
+    return _M_dropped.load(std::memory_order_relaxed);
+}
+
+void async_sink::wake() {
+    std::unique_lock<std::mutex> locker(_M_mutex);
+    _M_wakeup.notify_one();
+}
+
+void async_sink::run() {
+    std::string batch;
+    std::uint64_t reported = 0;
+    for (;;) {
+        batch.clear();
+        std::size_t n = 0;
+        while (n < _M_options.batch_size
+                && _M_ring.pop([&batch] (std::string const &record) {
+                    batch += record;
+                }))
+            ++n;
+
+        if (_M_options.overflow == count) {
+            std::uint64_t dropped = _M_dropped.load(std::memory_order_relaxed);
+            if (dropped != reported) {
+                std::ostringstream oss;
+                oss << "[logging] " << dropped - reported
+                    << " record(s) dropped, ring full\n";
+                batch += oss.str();
+                reported = dropped;
+            }
+        }
+        if (!batch.empty() && _M_stream)
+            _M_stream->write(batch.data(), batch.size());
+
+        if (n == _M_options.batch_size)
+            continue;
+
+        // caught up: flush, tell flush() callers, then sleep
+        if (_M_stream)
+            _M_stream->flush();
+        std::unique_lock<std::mutex> locker(_M_mutex);
+        _M_flushed = _M_ring.popped();
+        _M_flushed_cond.notify_all();
+        if (_M_stopping.load() && _M_ring.popped() == _M_ring.pushed())
+            return;
+        _M_sleeping.store(true);
+        // a producer that missed the flag is picked up after idle_wait
+        if (_M_ring.popped() == _M_ring.pushed() && !_M_stopping.load())
+            _M_wakeup.wait_for(locker, _M_options.idle_wait);
+        _M_sleeping.store(false);
+    }
+}
+
+}  // namespace org
@@ -0,0 +1,134 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+
+#include "log_timestamp.hpp"
+
+namespace {
+
+std::atomic<int> current_mode(org::log_timestamp::seconds);
+
+// the calendar part of the last second this thread logged in
+struct calendar_cache {
+    calendar_cache()
+        : second(static_cast<std::time_t>(-1))
+        , date_size(0)
+        , zone_size(0)
+    {
+    }
+
+    std::time_t second;
+    char date[24];
+    std::size_t date_size;
+    char zone[8];
+    std::size_t zone_size;
+};
+
+char const digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// exactly width digits, zero padded; width must be even
+char* put_fixed(char *out, std::uint32_t value, int width) {
+    for (int i = width - 2; i >= 0; i -= 2) {
+        std::uint32_t pair = value % 100;
+        value /= 100;
+        out[i] = digit_pairs[2 * pair];
+        out[i + 1] = digit_pairs[2 * pair + 1];
+    }
+    return out + width;
+}
+
+char* put_unsigned(char *out, std::uint64_t value) {
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    do {
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    std::size_t n = static_cast<std::size_t>(tmp + sizeof(tmp) - p);
+    std::memcpy(out, p, n);
+    return out + n;
+}
+
+void refresh(calendar_cache &cache, std::time_t second) {
+    struct tm tm;
+    // FIXME non standard localtime_r
+    if (!localtime_r(&second, &tm))
+        throw std::runtime_error("localtime_r");
+    cache.date_size = std::strftime(
+            cache.date, sizeof(cache.date), "%Y-%m-%d %H:%M:%S", &tm);
+    cache.zone_size = std::strftime(
+            cache.zone, sizeof(cache.zone), "%z", &tm);
+    if (!cache.date_size)
+        throw std::runtime_error("strftime");
+    cache.second = second;
+}
+
+std::chrono::steady_clock::time_point origin() {
+    static std::chrono::steady_clock::time_point const start =
+        std::chrono::steady_clock::now();
+    return start;
+}
+
+}
+
+namespace org {
+
+void log_timestamp::set_mode(mode m) {
+    current_mode.store(m, std::memory_order_relaxed);
+    if (m == monotonic)
+        origin();
+}
+
+log_timestamp::mode log_timestamp::get_mode() {
+    return static_cast<mode>(current_mode.load(std::memory_order_relaxed));
+}
+
+std::size_t log_timestamp::format(char *out) {
+    char *p = out;
+    mode m = get_mode();
+    if (m == monotonic) {
+        std::int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - origin()).count();
+        p = put_unsigned(p, static_cast<std::uint64_t>(us / 1000000));
+        *p++ = '.';
+        p = put_fixed(p, static_cast<std::uint32_t>(us % 1000000), 6);
+        *p = '\0';
+        return static_cast<std::size_t>(p - out);
+    }
+
+    std::int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    std::time_t second = static_cast<std::time_t>(us / 1000000);
+    static thread_local calendar_cache cache;
+    if (second != cache.second)
+        refresh(cache, second);
+
+    std::memcpy(p, cache.date, cache.date_size);
+    p += cache.date_size;
+    if (m == microseconds) {
+        *p++ = '.';
+        p = put_fixed(p, static_cast<std::uint32_t>(us % 1000000), 6);
+    }
+    if (cache.zone_size) {
+        *p++ = ' ';
+        std::memcpy(p, cache.zone, cache.zone_size);
+        p += cache.zone_size;
+    }
+    *p = '\0';
+    return static_cast<std::size_t>(p - out);
+}
+
+}  // namespace org
@@ -7,10 +7,14 @@ namespace org {
 
 logging::logging(std::ostream *stream)
     : _M_stream(stream)
+    , _M_sync(stream, &_M_mutex)
+    , _M_sink(&_M_sync)
+    , _M_dropped(0)
 {
 }
 
 logging::~logging() {
+    stop_async();
     _M_stream = NULL;
 }
 
@@ -33,24 +37,66 @@ std::ostream* logging::tie() {
 
 std::ostream* logging::tie(std::ostream *stream) {
     std::ostream *orig = _M_stream;
+    bool async = is_async();
+    // whatever is queued still goes to the old stream
+    stop_async();
     _M_stream = stream;
+    _M_sync = ostream_sink(stream, &_M_mutex);
+    if (async)
+        start_async(_M_async_options);
     return orig;
 }
 
+std::mutex* logging::get_mutex() {
+    return &_M_mutex;
+}
+
+void logging::start_async(async_sink::options const &opts) {
+    stop_async();
+    _M_async_options = opts;
+    _M_async.reset(new async_sink(_M_stream, opts));
+    _M_sink.store(_M_async.get());
+}
+
+void logging::stop_async() {
+    if (!_M_async)
+        return;
+    _M_sink.store(&_M_sync);
+    _M_dropped += _M_async->dropped();
+    // the destructor drains the ring
+    _M_async.reset();
+}
+
+bool logging::is_async() const {
+    return _M_async != NULL;
+}
+
+void logging::flush() {
+    _M_sink.load()->flush();
+}
+
+std::uint64_t logging::dropped() const {
+    return _M_dropped + (_M_async ? _M_async->dropped() : 0);
+}
+
 loggingstream logging::debug() {
-    return loggingstream("D", _M_stream, &_M_mutex);
+    return loggingstream("D", _M_sink.load());
 }
 
 loggingstream logging::info() {
-    return loggingstream("I", _M_stream, &_M_mutex);
+    return loggingstream("I", _M_sink.load());
 }
 
 loggingstream logging::warn() {
-    return loggingstream("W", _M_stream, &_M_mutex);
+    return loggingstream("W", _M_sink.load());
 }
 
 loggingstream logging::error() {
-    return loggingstream("E", _M_stream, &_M_mutex);
+    return loggingstream("E", _M_sink.load());
+}
+
+void logging::set_timestamp_mode(log_timestamp::mode m) {
+    log_timestamp::set_mode(m);
 }
 
 }  // namespace org
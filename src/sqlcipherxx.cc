@@ -1,18 +1,34 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <iomanip>
+#include <list>
+#include <mutex>
 #include <ostream>
+#include <random>
 #include <sstream>
 #include <stdexcept>
 #include <memory>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 
 #include <sqlite3.h>
 
+#include "busy_policy.hpp"
+#include "kdf_cache.hpp"
 #include "sqlcipherxx.hpp"
 
 namespace {
 class errors {
     public:
         static void throws(int ecode, std::string const &msg) {
-            throw std::runtime_error(message(ecode, msg));
+            throw org::sqlite_error(
+                    org::make_sqlite_error(ecode),
+                    message(ecode, msg));
         }
 
         static std::string message(
@@ -28,11 +44,217 @@ class errors {
             return es.str();
         }
 };
+
+std::size_t const key_size = 32;
+std::size_t const salt_size = 16;
+
+// An encrypted database starts with its salt. A new or empty file has none
+// yet: SQLCipher picks it on the first write, and every connection keyed
+// before that has to end up with the same one.
+bool salt_for(std::string const &filename, org::kdf_cache::bytes &salt) {
+    salt.assign(salt_size, 0);
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in)
+        return false;
+    in.read(reinterpret_cast<char*>(salt.data()), salt.size());
+    return static_cast<std::size_t>(in.gcount()) == salt.size();
+}
+
+// x'<key><salt>' tells SQLCipher to use the bytes as is, without KDF
+std::string raw_key(
+        org::sqlcipherxx::blob_view const &key,
+        org::sqlcipherxx::blob_view const &salt) {
+    static char const digits[] = "0123456789ABCDEF";
+    std::string blob("x'");
+    blob.reserve(3 + 2 * (key.size() + salt.size()));
+    for (unsigned char c : key) {
+        blob += digits[c >> 4];
+        blob += digits[c & 0xf];
+    }
+    for (unsigned char c : salt) {
+        blob += digits[c >> 4];
+        blob += digits[c & 0xf];
+    }
+    blob += '\'';
+    return blob;
+}
+
+// Reports export progress as bytes written to the target file against the
+// size of the source; runs inside sqlite3_step, so it must not touch the
+// connection itself.
+struct export_progress {
+    std::string target;
+    std::int64_t total;
+    std::function<bool(std::int64_t, std::int64_t)> callback;
+
+    static int handler(void *p) {
+        export_progress *self = static_cast<export_progress*>(p);
+        std::error_code ec;
+        std::uintmax_t done = std::filesystem::file_size(self->target, ec);
+        if (ec)
+            done = 0;
+        try {
+            return self->callback(static_cast<std::int64_t>(done), self->total)
+                ? 0 : 1;
+        } catch (...) {
+            return 1;
+        }
+    }
+};
+
+int busy_handler(void *policy, int count) {
+    try {
+        return static_cast<org::busy_policy*>(policy)->wait(count) ? 1 : 0;
+    } catch (...) {
+        return 0;
+    }
+}
+
+int wal_handler(void *hook, sqlite3*, char const *schema, int frames) {
+    try {
+        (*static_cast<org::sqlcipherxx::wal_hook*>(hook))(schema, frames);
+    } catch (...) {
+    }
+    return SQLITE_OK;
+}
+
+class sqlite_category_impl : public std::error_category {
+    public:
+        virtual char const* name() const noexcept {
+            return "sqlite";
+        }
+
+        virtual std::string message(int ecode) const {
+            char const *p = ::sqlite3_errstr(ecode);
+            return p ? p : "unknown error";
+        }
+
+        virtual std::error_condition
+        default_error_condition(int ecode) const noexcept {
+            switch (ecode & 0xff) {
+                case SQLITE_BUSY:
+                case SQLITE_LOCKED:
+                    return std::errc::resource_unavailable_try_again;
+                case SQLITE_NOMEM:
+                    return std::errc::not_enough_memory;
+                case SQLITE_INTERRUPT:
+                    return std::errc::interrupted;
+                default:
+                    return std::error_condition(ecode, *this);
+            }
+        }
+};
 }
 
 namespace org {
 
-sqlcipherxx::sqlcipherxx() :_M_db(NULL) {
+std::error_category const& sqlite_category() {
+    static sqlite_category_impl category;
+    return category;
+}
+
+std::error_code make_sqlite_error(int ecode) {
+    return std::error_code(ecode, sqlite_category());
+}
+
+bool is_busy(std::error_code const &ec) {
+    if (ec.category() != sqlite_category())
+        return false;
+    int primary = ec.value() & 0xff;
+    return primary == SQLITE_BUSY || primary == SQLITE_LOCKED;
+}
+
+sqlite_error::sqlite_error(std::error_code const &ec, std::string const &what)
+    : std::runtime_error(what)
+    , _M_code(ec)
+{
+}
+
+std::error_code const& sqlite_error::code() const {
+    return _M_code;
+}
+
+/**
+ * Idle prepared statements of one connection, keyed by SQL text and evicted
+ * least recently used first. Statements handed out by prepare_cached() are
+ * checked out of the cache and come back (reset, bindings cleared) when the
+ * last shared_ptr to them is dropped, so a statement is never shared by two
+ * users at once.
+ */
+class sqlcipherxx::statement_cache {
+    public:
+        explicit statement_cache(std::size_t capacity)
+            : _M_capacity(capacity)
+        {
+        }
+
+        ~statement_cache() {
+            clear();
+        }
+
+        statement* take(std::string const &sql) {
+            std::unique_lock<std::mutex> locker(_M_mutex);
+            index_type::iterator it = _M_index.find(sql);
+            if (it == _M_index.end())
+                return NULL;
+            statement *stmt = it->second->second;
+            _M_lru.erase(it->second);
+            _M_index.erase(it);
+            return stmt;
+        }
+
+        void give(std::string const &sql, statement *stmt) {
+            std::unique_lock<std::mutex> locker(_M_mutex);
+            _M_lru.push_front(std::make_pair(sql, stmt));
+            _M_index.insert(std::make_pair(sql, _M_lru.begin()));
+            trim(_M_capacity);
+        }
+
+        void resize(std::size_t capacity) {
+            std::unique_lock<std::mutex> locker(_M_mutex);
+            _M_capacity = capacity;
+            trim(_M_capacity);
+        }
+
+        void clear() {
+            std::unique_lock<std::mutex> locker(_M_mutex);
+            trim(0);
+        }
+    private:
+        typedef std::list<std::pair<std::string, statement*> > lru_type;
+        typedef std::unordered_multimap<std::string, lru_type::iterator>
+            index_type;
+
+        void trim(std::size_t capacity) {
+            while (_M_lru.size() > capacity) {
+                lru_type::iterator victim = --_M_lru.end();
+                std::pair<index_type::iterator, index_type::iterator> range =
+                    _M_index.equal_range(victim->first);
+                for (index_type::iterator it = range.first;
+                        it != range.second; ++it) {
+                    if (it->second == victim) {
+                        _M_index.erase(it);
+                        break;
+                    }
+                }
+                delete victim->second;
+                _M_lru.erase(victim);
+            }
+        }
+
+        lru_type _M_lru;
+        index_type _M_index;
+        std::size_t _M_capacity;
+        std::mutex _M_mutex;
+};
+
+sqlcipherxx::sqlcipherxx()
+    : _M_db(NULL)
+    , _M_cache(new statement_cache(64))
+    , _M_savepoints(0)
+    , _M_has_profile(false)
+    , _M_flags(0)
+{
 }
 
 sqlcipherxx::~sqlcipherxx() {
@@ -46,7 +268,13 @@ sqlcipherxx::operator bool() const {
 sqlcipherxx::sqlcipherxx(
         std::string const &filename,
         int flags,
-        std::string const &vfs) {
+        std::string const &vfs)
+    : _M_db(NULL)
+    , _M_cache(new statement_cache(64))
+    , _M_savepoints(0)
+    , _M_has_profile(false)
+    , _M_flags(0)
+{
     open(filename, flags, vfs);
 }
 
@@ -60,11 +288,44 @@ sqlcipherxx& sqlcipherxx::open(
     int rc = ::sqlite3_open_v2(filename.c_str(), &_M_db, flags, zVfs);
     if (rc != SQLITE_OK)
         errors::throws(rc, "sqlite3_open_v2");
+    _M_flags = flags;
+    _M_vfs = vfs;
+    if (_M_busy)
+        set_busy_policy(_M_busy);
+    if (_M_wal_hook)
+        sqlite3_wal_hook(_M_db, wal_handler, &_M_wal_hook);
     return *this;
 }
 
+sqlcipherxx& sqlcipherxx::open(
+        std::string const &filename,
+        cipher_profile const &profile,
+        int flags,
+        std::string const &vfs) {
+    set_cipher_profile(profile);
+    return open(filename, flags, vfs);
+}
+
+void sqlcipherxx::set_cipher_profile(cipher_profile const &profile) {
+    _M_profile = profile;
+    _M_has_profile = true;
+}
+
+cipher_profile const& sqlcipherxx::get_cipher_profile() const {
+    return _M_profile;
+}
+
+void sqlcipherxx::apply_cipher_profile() {
+    if (!_M_has_profile)
+        return;
+    std::vector<std::string> pragmas = _M_profile.pragmas();
+    for (std::size_t i = 0; i < pragmas.size(); ++i)
+        execute(pragmas[i]);
+}
+
 void sqlcipherxx::close() {
     if (_M_db) {
+        _M_cache->clear();
         int rc = ::sqlite3_close(_M_db);
         if (rc != SQLITE_OK)
             throws(rc, "sqlite3_close");
@@ -72,6 +333,180 @@ void sqlcipherxx::close() {
     }
 }
 
+void sqlcipherxx::key(std::string const &passphrase) {
+    std::string filename = db_filename();
+    kdf_cache::bytes salt;
+    // temporary databases, new ones, ones we cannot read the salt of and
+    // ones whose header is plaintext go through SQLCipher's own KDF
+    if (filename.empty()
+            || _M_profile.plaintext_header_size > 0
+            || !salt_for(filename, salt)) {
+        int rc = sqlite3_key(
+                _M_db,
+                passphrase.data(), static_cast<int>(passphrase.size()));
+        if (rc != SQLITE_OK)
+            throws(rc, "sqlite3_key");
+        apply_cipher_profile();
+        return;
+    }
+    kdf_cache::bytes derived = kdf_cache::instance()->derive(
+            passphrase, salt,
+            _M_profile.kdf_iter, _M_profile.kdf_algorithm,
+            key_size);
+    key_raw(
+            blob_view(derived.data(), derived.size()),
+            blob_view(salt.data(), salt.size()));
+    std::fill(derived.begin(), derived.end(), 0);
+}
+
+void sqlcipherxx::key_raw(blob_view const &key, blob_view const &salt) {
+    if (key.size() != key_size)
+        throw std::invalid_argument("key_raw: key must be 32 bytes");
+    if (!salt.empty() && salt.size() != salt_size)
+        throw std::invalid_argument("key_raw: salt must be 16 bytes");
+    std::string blob = raw_key(key, salt);
+    int rc = sqlite3_key(_M_db, blob.data(), static_cast<int>(blob.size()));
+    std::fill(blob.begin(), blob.end(), 0);
+    if (rc != SQLITE_OK)
+        throws(rc, "sqlite3_key");
+    apply_cipher_profile();
+}
+
+void sqlcipherxx::rekey(std::string const &passphrase) {
+    int rc = sqlite3_rekey(
+            _M_db,
+            passphrase.data(), static_cast<int>(passphrase.size()));
+    if (rc != SQLITE_OK)
+        throws(rc, "sqlite3_rekey");
+}
+
+void sqlcipherxx::export_to(
+        std::string const &filename,
+        std::string const &passphrase,
+        progress_callback const &progress) {
+    static char const alias[] = "sqlcipherxx_export";
+    std::string key;
+    if (!passphrase.empty()) {
+        // derive through the cache with a fresh salt, so reopening the copy
+        // with key() is a cache hit
+        kdf_cache::bytes salt = kdf_cache::random_bytes(salt_size);
+        kdf_cache::bytes derived = kdf_cache::instance()->derive(
+                passphrase, salt,
+                _M_profile.kdf_iter, _M_profile.kdf_algorithm,
+                key_size);
+        key = raw_key(
+                blob_view(derived.data(), derived.size()),
+                blob_view(salt.data(), salt.size()));
+        std::fill(derived.begin(), derived.end(), 0);
+    }
+    {
+        std::shared_ptr<statement> attach = prepare(
+                std::string("ATTACH DATABASE ? AS ") + alias + " KEY ?");
+        attach->set_string(1, filename);
+        attach->set_string(2, key);
+        attach->execute();
+        std::fill(key.begin(), key.end(), 0);
+    }
+
+    export_progress state;
+    state.target = filename;
+    state.total = 0;
+    state.callback = progress;
+    try {
+        if (_M_has_profile && !passphrase.empty()) {
+            std::vector<std::string> pragmas = _M_profile.pragmas(alias);
+            for (std::size_t i = 0; i < pragmas.size(); ++i)
+                execute(pragmas[i]);
+        }
+        if (progress) {
+            std::shared_ptr<statement> size = prepare(
+                    "SELECT page_count * page_size"
+                    " FROM pragma_page_count(), pragma_page_size()");
+            if (size->next())
+                state.total = size->get_int64(0);
+            sqlite3_progress_handler(
+                    _M_db, 1000, export_progress::handler, &state);
+        }
+        std::shared_ptr<statement> copy = prepare(
+                "SELECT sqlcipher_export(?)");
+        copy->set_string(1, alias);
+        copy->next();
+        sqlite3_progress_handler(_M_db, 0, NULL, NULL);
+        execute(std::string("DETACH DATABASE ") + alias);
+    } catch (...) {
+        sqlite3_progress_handler(_M_db, 0, NULL, NULL);
+        std::error_code ignored;
+        try_execute(std::string("DETACH DATABASE ") + alias, ignored);
+        std::remove(filename.c_str());
+        throw;
+    }
+    if (progress)
+        progress(state.total, state.total);
+}
+
+void sqlcipherxx::rekey_exclusive(
+        std::string const &passphrase,
+        progress_callback const &progress) {
+    std::string filename = db_filename();
+    if (filename.empty())
+        throw std::logic_error("rekey_exclusive: not a file database");
+    std::string journal;
+    {
+        std::shared_ptr<statement> mode = prepare("PRAGMA main.journal_mode");
+        if (mode->next())
+            journal = mode->get_string(0);
+    }
+    // an idle connection in rollback journal mode holds no lock, so there
+    // would be no telling whether others have the file open
+    if (journal != "wal")
+        throw std::logic_error("rekey_exclusive: database is not in WAL mode");
+
+    // WAL connections hold a shared lock on the file for as long as they
+    // are open, so the exclusive lock is only granted when we are alone;
+    // it then keeps others out until the file has been replaced
+    execute("PRAGMA main.locking_mode = EXCLUSIVE");
+    std::string target = filename + "-rekey";
+    bool left_wal = false;
+    try {
+        try {
+            begin_immediate()->commit();
+        } catch (sqlite_error const &e) {
+            if (!is_busy(e.code()))
+                throw;
+            throw sqlite_error(e.code(),
+                    "rekey_exclusive: other connections have the database open");
+        }
+        // checkpoints and removes the WAL and its index while we still hold
+        // the lock, so nothing is left lying next to the new file; a memory
+        // journal leaves no -journal file either
+        execute("PRAGMA main.journal_mode = MEMORY");
+        left_wal = true;
+        std::remove(target.c_str());
+        export_to(target, passphrase, progress);
+        if (std::rename(target.c_str(), filename.c_str()) != 0) {
+            int e = errno;
+            std::remove(target.c_str());
+            throw std::system_error(e, std::generic_category(), "rename");
+        }
+    } catch (...) {
+        // leaving exclusive mode takes effect at the next access, and has to
+        // come first: back in WAL mode the lock would be kept
+        std::error_code ignored;
+        try_execute("PRAGMA main.locking_mode = NORMAL", ignored);
+        try_execute("PRAGMA main.application_id", ignored);
+        if (left_wal)
+            try_execute("PRAGMA main.journal_mode = WAL", ignored);
+        throw;
+    }
+
+    int flags = _M_flags;
+    std::string vfs = _M_vfs;
+    close();
+    open(filename, flags, vfs);
+    key(passphrase);
+    execute("PRAGMA journal_mode = WAL");
+}
+
 void sqlcipherxx::execute(std::string const &sql) {
     char *errmsg = NULL;
     int rc = ::sqlite3_exec(_M_db, sql.c_str(), NULL, NULL, &errmsg);
@@ -81,12 +516,22 @@ void sqlcipherxx::execute(std::string const &sql) {
             message.assign(errmsg);
             ::sqlite3_free(errmsg);
             errmsg = NULL;
-            throw std::runtime_error(message);
+            throw sqlite_error(make_sqlite_error(rc), message);
         }
         throws(rc, "sqlite3_exec");
     }
 }
 
+bool sqlcipherxx::try_execute(std::string const &sql, std::error_code &ec) {
+    int rc = ::sqlite3_exec(_M_db, sql.c_str(), NULL, NULL, NULL);
+    if (rc != SQLITE_OK) {
+        ec = make_sqlite_error(rc);
+        return false;
+    }
+    ec.clear();
+    return true;
+}
+
 std::shared_ptr<sqlcipherxx::transaction>
 sqlcipherxx::begin_transaction() {
     this->execute("BEGIN TRANSACTION");
@@ -111,6 +556,167 @@ sqlcipherxx::begin_immediate() {
     return std::shared_ptr<transaction>(new transaction(*this));
 }
 
+std::shared_ptr<sqlcipherxx::transaction>
+sqlcipherxx::begin(transaction_kind kind) {
+    switch (kind) {
+        case immediate:
+            return begin_immediate();
+        case exclusive:
+            return begin_exclusive();
+        default:
+            return begin_deferred();
+    }
+}
+
+std::shared_ptr<sqlcipherxx::savepoint>
+sqlcipherxx::begin_savepoint(std::string const &name) {
+    std::string sp(name);
+    if (sp.empty()) {
+        std::ostringstream oss;
+        oss << "sqlcipherxx_sp" << ++_M_savepoints;
+        sp = oss.str();
+    }
+    this->execute("SAVEPOINT " + quote(sp));
+    return std::shared_ptr<savepoint>(new savepoint(*this, sp));
+}
+
+std::shared_ptr<sqlcipherxx::snapshot>
+sqlcipherxx::snapshot_get(std::string const &schema) {
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    std::shared_ptr<transaction> tran;
+    if (autocommit()) {
+        // a snapshot can only be taken inside a read transaction
+        tran = begin_deferred();
+        std::shared_ptr<statement> touch = prepare(
+                "SELECT COUNT(*) FROM " + quote(schema) + ".sqlite_master");
+        touch->next();
+    }
+    sqlite3_snapshot *p = NULL;
+    int rc = sqlite3_snapshot_get(_M_db, schema.c_str(), &p);
+    if (rc != SQLITE_OK)
+        throws(rc, "sqlite3_snapshot_get");
+    std::shared_ptr<snapshot> snap(new snapshot(p));
+    if (tran)
+        tran->commit();
+    return snap;
+#else
+    (void) schema;
+    errors::throws(SQLITE_ERROR, "built without SQLITE_ENABLE_SNAPSHOT");
+    return std::shared_ptr<snapshot>();
+#endif
+}
+
+std::shared_ptr<sqlcipherxx::transaction>
+sqlcipherxx::snapshot_open(snapshot const &snap, std::string const &schema) {
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    // a fresh connection does not know the file is in WAL mode until it has
+    // read from it
+    execute("PRAGMA " + quote(schema) + ".application_id");
+    std::shared_ptr<transaction> tran = begin_deferred();
+    int rc = sqlite3_snapshot_open(_M_db, schema.c_str(), snap.get());
+    if (rc != SQLITE_OK) {
+        tran->abandon();
+        throws(rc, "sqlite3_snapshot_open");
+    }
+    return tran;
+#else
+    (void) snap;
+    (void) schema;
+    errors::throws(SQLITE_ERROR, "built without SQLITE_ENABLE_SNAPSHOT");
+    return std::shared_ptr<transaction>();
+#endif
+}
+
+int sqlcipherxx::snapshot_cmp(snapshot const &a, snapshot const &b) {
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    return sqlite3_snapshot_cmp(a.get(), b.get());
+#else
+    (void) a;
+    (void) b;
+    errors::throws(SQLITE_ERROR, "built without SQLITE_ENABLE_SNAPSHOT");
+    return 0;
+#endif
+}
+
+bool sqlcipherxx::snapshot_supported() {
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    return sqlite3_compileoption_used("ENABLE_SNAPSHOT") != 0;
+#else
+    return false;
+#endif
+}
+
+std::shared_ptr<sqlcipherxx::backup>
+sqlcipherxx::begin_backup(
+        sqlcipherxx &dest,
+        int pages_per_step,
+        std::chrono::microseconds sleep) {
+    if (pages_per_step == 0)
+        throw std::invalid_argument("pages_per_step must not be 0");
+    sqlite3_backup *b = sqlite3_backup_init(dest._M_db, "main", _M_db, "main");
+    if (b == NULL)
+        dest.throws(sqlite3_errcode(dest._M_db), "sqlite3_backup_init");
+    return std::shared_ptr<backup>(new backup(b, pages_per_step, sleep));
+}
+
+sqlcipherxx::retry_policy::retry_policy()
+    : max_attempts(10)
+    , initial_delay(1000)
+    , max_delay(100000)
+{
+}
+
+int sqlcipherxx::run_in_transaction(
+        transaction_kind kind,
+        std::function<void(sqlcipherxx&)> const &fn,
+        retry_policy const &policy) {
+    return run_with_retry([this, kind, &fn] {
+        std::shared_ptr<transaction> tran = begin(kind);
+        try {
+            fn(*this);
+            tran->commit();
+        } catch (...) {
+            tran->abandon();
+            throw;
+        }
+    }, policy);
+}
+
+int sqlcipherxx::run_with_retry(
+        std::function<void()> const &fn,
+        retry_policy const &policy) {
+    static thread_local std::minstd_rand rng(std::random_device{}());
+    std::chrono::microseconds delay = policy.initial_delay;
+    for (int attempt = 1; ; ++attempt) {
+        try {
+            fn();
+            return attempt;
+        } catch (sqlite_error const &e) {
+            if (!is_busy(e.code()) || attempt >= policy.max_attempts)
+                throw;
+            if (policy.on_retry)
+                policy.on_retry(attempt, e.code());
+        }
+        // sleep somewhere in [delay / 2, delay] so retrying writers spread out
+        std::uniform_int_distribution<long long> jitter(
+                delay.count() / 2, delay.count());
+        std::this_thread::sleep_for(std::chrono::microseconds(jitter(rng)));
+        delay = std::min(delay * 2, policy.max_delay);
+    }
+}
+
+bool sqlcipherxx::autocommit() const {
+    return sqlite3_get_autocommit(_M_db) != 0;
+}
+
+sqlite3_int64 sqlcipherxx::changes() const {
+    return sqlite3_changes(_M_db);
+}
+
+sqlite3_int64 sqlcipherxx::last_insert_rowid() const {
+    return sqlite3_last_insert_rowid(_M_db);
+}
+
 std::shared_ptr<sqlcipherxx::statement>
 sqlcipherxx::prepare(std::string const &sql) {
     sqlite3_stmt *stmt = NULL;
@@ -124,6 +730,69 @@ sqlcipherxx::prepare(std::string const &sql) {
     return std::shared_ptr<statement>(new statement(stmt));
 }
 
+std::shared_ptr<sqlcipherxx::statement>
+sqlcipherxx::try_prepare(std::string const &sql, std::error_code &ec) {
+    sqlite3_stmt *stmt = NULL;
+    int rc = ::sqlite3_prepare_v2(
+            _M_db,
+            sql.c_str(), sql.length(),
+            &stmt,
+            NULL);
+    if (rc != SQLITE_OK) {
+        ec = make_sqlite_error(rc);
+        return std::shared_ptr<statement>();
+    }
+    ec.clear();
+    return std::shared_ptr<statement>(new statement(stmt));
+}
+
+std::shared_ptr<sqlcipherxx::statement>
+sqlcipherxx::prepare_cached(std::string const &sql) {
+    statement *cached = _M_cache->take(sql);
+    if (!cached) {
+        sqlite3_stmt *stmt = NULL;
+        int rc = ::sqlite3_prepare_v3(
+                _M_db,
+                sql.c_str(), sql.length(),
+                SQLITE_PREPARE_PERSISTENT,
+                &stmt,
+                NULL);
+        if (rc != SQLITE_OK)
+            throws(rc, "sqlite3_prepare_v3");
+        cached = new statement(stmt);
+    }
+    std::weak_ptr<statement_cache> cache(_M_cache);
+    return std::shared_ptr<statement>(
+            cached,
+            [cache, sql] (statement *stmt) {
+                std::shared_ptr<statement_cache> owner = cache.lock();
+                if (!owner) {
+                    delete stmt;
+                    return;
+                }
+                // sqlite3_reset repeats the error of the last step, which
+                // the caller has already seen; the statement is reusable
+                sqlite3_reset(stmt->_M_stmt);
+                sqlite3_clear_bindings(stmt->_M_stmt);
+                owner->give(sql, stmt);
+            });
+}
+
+void sqlcipherxx::set_statement_cache_size(std::size_t size) {
+    _M_cache->resize(size);
+}
+
+std::string sqlcipherxx::quote(std::string const &identifier) {
+    std::string quoted("\"");
+    for (std::size_t i = 0, n = identifier.size(); i < n; ++i) {
+        if (identifier[i] == '"')
+            quoted += '"';
+        quoted += identifier[i];
+    }
+    quoted += '"';
+    return quoted;
+}
+
 int sqlcipherxx::is_threadsafe() {
     return sqlite3_threadsafe();
 }
@@ -139,11 +808,10 @@ sqlcipherxx::statement::statement(sqlite3_stmt *stmt)
 }
 
 sqlcipherxx::statement::~statement() {
-    if (_M_stmt) {
-        int rc = ::sqlite3_finalize(_M_stmt);
-        if (rc != SQLITE_OK)
-            throws(rc, "sqlite3_finalize");
-    }
+    // sqlite3_finalize always frees the statement; what it returns is the
+    // last step's error, already reported (or ignored) by whoever stepped
+    if (_M_stmt)
+        ::sqlite3_finalize(_M_stmt);
 }
 
 bool sqlcipherxx::statement::execute() {
@@ -152,8 +820,16 @@ bool sqlcipherxx::statement::execute() {
     rc = sqlite3_step(_M_stmt);
     if (rc != SQLITE_OK
             && rc != SQLITE_ROW
-            && rc != SQLITE_DONE)
-        throws(rc, "sqlite3_step");
+            && rc != SQLITE_DONE) {
+        // reset once the message is built, otherwise the error stays on the
+        // statement and a cached one fails again when it is finalized
+        try {
+            throws(rc, "sqlite3_step");
+        } catch (...) {
+            sqlite3_reset(_M_stmt);
+            throw;
+        }
+    }
     is_query = this->ncols() > 0;
     rc = sqlite3_reset(_M_stmt);
     if (rc != SQLITE_OK)
@@ -164,15 +840,67 @@ bool sqlcipherxx::statement::execute() {
 bool sqlcipherxx::statement::next() {
     int rc = sqlite3_step(_M_stmt);
     if (rc != SQLITE_ROW
-            && rc != SQLITE_DONE)
-        throws(rc, "sqlite3_step");
+            && rc != SQLITE_DONE) {
+        // see execute()
+        try {
+            throws(rc, "sqlite3_step");
+        } catch (...) {
+            sqlite3_reset(_M_stmt);
+            throw;
+        }
+    }
     return rc == SQLITE_ROW;
 }
 
+bool sqlcipherxx::statement::try_execute(std::error_code &ec) {
+    int rc = sqlite3_step(_M_stmt);
+    bool is_query = this->ncols() > 0;
+    // on failure sqlite3_reset repeats the step error, keep the first one
+    int rc2 = sqlite3_reset(_M_stmt);
+    if (rc != SQLITE_OK
+            && rc != SQLITE_ROW
+            && rc != SQLITE_DONE)
+        ec = make_sqlite_error(rc);
+    else if (rc2 != SQLITE_OK)
+        ec = make_sqlite_error(rc2);
+    else
+        ec.clear();
+    return is_query;
+}
+
+bool sqlcipherxx::statement::try_next(std::error_code &ec) {
+    int rc = sqlite3_step(_M_stmt);
+    if (rc == SQLITE_ROW || rc == SQLITE_DONE) {
+        ec.clear();
+        return rc == SQLITE_ROW;
+    }
+    ec = make_sqlite_error(rc);
+    sqlite3_reset(_M_stmt);
+    return false;
+}
+
+void sqlcipherxx::statement::reset() {
+    int rc = sqlite3_reset(_M_stmt);
+    if (rc != SQLITE_OK)
+        throws(rc, "sqlite3_reset");
+}
+
+void sqlcipherxx::statement::clear_bindings() {
+    sqlite3_clear_bindings(_M_stmt);
+}
+
 int sqlcipherxx::statement::ncols() {
     return sqlite3_column_count(_M_stmt);
 }
 
+int sqlcipherxx::statement::nparams() {
+    return sqlite3_bind_parameter_count(_M_stmt);
+}
+
+bool sqlcipherxx::statement::readonly() const {
+    return sqlite3_stmt_readonly(_M_stmt) != 0;
+}
+
 std::string sqlcipherxx::statement::colname(int icol) {
     char const *p = sqlite3_column_name(_M_stmt, icol);
     if (!p)
@@ -186,7 +914,46 @@ std::string sqlcipherxx::statement::get_string(int icol, bool *null) {
         throw std::runtime_error("sqlite3_column_text");
     if (null)
         *null = this->is_null(icol);
-    return std::string(reinterpret_cast<char const*>(p));
+    return std::string(
+            reinterpret_cast<char const*>(p),
+            sqlite3_column_bytes(_M_stmt, icol));
+}
+
+sqlite3_int64 sqlcipherxx::statement::get_int64(int icol, bool *null) {
+    sqlite3_int64 i = sqlite3_column_int64(_M_stmt, icol);
+    if (null)
+        *null = this->is_null(icol);
+    return i;
+}
+
+std::string_view sqlcipherxx::statement::get_view(int icol, bool *null) {
+    // sqlite3_column_bytes must come after the conversion done by
+    // sqlite3_column_text, otherwise the length may be stale
+    unsigned char const* p = sqlite3_column_text(_M_stmt, icol);
+    bool isnull = this->is_null(icol);
+    if (!p && !isnull)
+        throw std::runtime_error("sqlite3_column_text");
+    if (null)
+        *null = isnull;
+    if (!p)
+        return std::string_view();
+    return std::string_view(
+            reinterpret_cast<char const*>(p),
+            sqlite3_column_bytes(_M_stmt, icol));
+}
+
+sqlcipherxx::blob_view
+sqlcipherxx::statement::get_blob(int icol, bool *null) {
+    void const* p = sqlite3_column_blob(_M_stmt, icol);
+    int n = sqlite3_column_bytes(_M_stmt, icol);
+    bool isnull = this->is_null(icol);
+    // zero-length blobs come back as NULL too, only NOMEM is an error
+    if (!p && !isnull
+            && sqlite3_errcode(sqlite3_db_handle(_M_stmt)) == SQLITE_NOMEM)
+        throw std::runtime_error("sqlite3_column_blob");
+    if (null)
+        *null = isnull;
+    return blob_view(p, p ? n : 0);
 }
 
 double sqlcipherxx::statement::get_double(int icol, bool *null) {
@@ -216,6 +983,50 @@ void sqlcipherxx::statement::set_double(int iparam, double const& value) {
         throws(rc, "sqlite3_bind_double");
 }
 
+void sqlcipherxx::statement::set_int64(int iparam, sqlite3_int64 value) {
+    int rc = sqlite3_bind_int64(
+            _M_stmt,
+            iparam,
+            value);
+    if (rc != SQLITE_OK)
+        throws(rc, "sqlite3_bind_int64");
+}
+
+void sqlcipherxx::statement::set_view(int iparam, std::string_view value) {
+    // a NULL pointer would bind SQL NULL instead of an empty string
+    int rc = sqlite3_bind_text64(
+            _M_stmt,
+            iparam,
+            value.data() ? value.data() : "",
+            value.size(),
+            NULL,
+            SQLITE_UTF8);
+    if (rc != SQLITE_OK)
+        throws(rc, "sqlite3_bind_text64");
+}
+
+void sqlcipherxx::statement::set_blob(int iparam, blob_view const &value) {
+    // a NULL pointer would bind SQL NULL instead of an empty blob
+    static unsigned char const empty = 0;
+    int rc = sqlite3_bind_blob64(
+            _M_stmt,
+            iparam,
+            value.data() ? value.data() : &empty,
+            value.size(),
+            NULL);
+    if (rc != SQLITE_OK)
+        throws(rc, "sqlite3_bind_blob64");
+}
+
+void sqlcipherxx::statement::set_zeroblob(int iparam, std::size_t size) {
+    int rc = sqlite3_bind_zeroblob64(
+            _M_stmt,
+            iparam,
+            size);
+    if (rc != SQLITE_OK)
+        throws(rc, "sqlite3_bind_zeroblob64");
+}
+
 void sqlcipherxx::statement::set_null(int iparam) {
     int rc = sqlite3_bind_null(
             _M_stmt,
@@ -228,6 +1039,10 @@ bool sqlcipherxx::statement::is_null(int icol) {
     return sqlite3_column_type(_M_stmt, icol) == SQLITE_NULL;
 }
 
+int sqlcipherxx::statement::coltype(int icol) {
+    return sqlite3_column_type(_M_stmt, icol);
+}
+
 
 std::string sqlcipherxx::statement::sql() const {
     char const *s = sqlite3_sql(_M_stmt);
@@ -237,10 +1052,12 @@ std::string sqlcipherxx::statement::sql() const {
 }
 
 std::string sqlcipherxx::statement::expanded_sql() const {
-    char const *s = sqlite3_expanded_sql(_M_stmt);
+    char *s = sqlite3_expanded_sql(_M_stmt);
     if (!s)
         throw std::runtime_error("sqlite3_sql");
-    return std::string(s);
+    std::string sql(s);
+    sqlite3_free(s);
+    return sql;
 }
 
 void sqlcipherxx::statement::throws(
@@ -248,7 +1065,7 @@ void sqlcipherxx::statement::throws(
         std::string const& message) {
     std::ostringstream es;
     es << errors::message(ecode, message) << ": " << this->expanded_sql();
-    throw std::runtime_error(es.str());
+    throw sqlite_error(make_sqlite_error(ecode), es.str());
 }
 
 sqlcipherxx::mutex::mutex(sqlite3_mutex* mutex, bool own)
@@ -303,11 +1120,129 @@ void sqlcipherxx::transaction::commit() {
 }
 
 void sqlcipherxx::transaction::rollback() {
-    if (!_M_completed)
+    // SQLite rolls back by itself after some errors, ROLLBACK would fail
+    if (!_M_completed && !_M_s.autocommit())
         _M_s.execute("ROLLBACK");
     _M_completed = true;
 }
 
+void sqlcipherxx::transaction::abandon() {
+    try {
+        rollback();
+    } catch (...) {
+    }
+    _M_completed = true;
+}
+
+sqlcipherxx::savepoint::savepoint(sqlcipherxx &s, std::string const &name)
+    : _M_s(s)
+    , _M_name(name)
+    , _M_completed(false)
+{
+}
+
+sqlcipherxx::savepoint::~savepoint() {
+    try {
+        release();
+    } catch (...) {
+        try {
+            rollback();
+        } catch (...) {
+        }
+    }
+}
+
+void sqlcipherxx::savepoint::release() {
+    if (!_M_completed && !_M_s.autocommit())
+        _M_s.execute("RELEASE " + quote(_M_name));
+    _M_completed = true;
+}
+
+void sqlcipherxx::savepoint::rollback() {
+    if (!_M_completed && !_M_s.autocommit()) {
+        _M_s.execute("ROLLBACK TO " + quote(_M_name));
+        _M_s.execute("RELEASE " + quote(_M_name));
+    }
+    _M_completed = true;
+}
+
+void sqlcipherxx::savepoint::rollback_to() {
+    if (_M_completed)
+        throw std::logic_error("savepoint already completed");
+    _M_s.execute("ROLLBACK TO " + quote(_M_name));
+}
+
+std::string const& sqlcipherxx::savepoint::name() const {
+    return _M_name;
+}
+
+sqlcipherxx::snapshot::snapshot(sqlite3_snapshot *p)
+    : _M_snapshot(p)
+{
+}
+
+sqlcipherxx::snapshot::~snapshot() {
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    sqlite3_snapshot_free(_M_snapshot);
+#endif
+}
+
+sqlite3_snapshot* sqlcipherxx::snapshot::get() const {
+    return _M_snapshot;
+}
+
+sqlcipherxx::backup::backup(
+        sqlite3_backup *b,
+        int pages_per_step,
+        std::chrono::microseconds sleep)
+    : _M_backup(b)
+    , _M_pages_per_step(pages_per_step)
+    , _M_sleep(sleep)
+    , _M_done(false)
+{
+}
+
+sqlcipherxx::backup::~backup() {
+    sqlite3_backup_finish(_M_backup);
+}
+
+bool sqlcipherxx::backup::step() {
+    if (_M_done)
+        return false;
+    int rc = sqlite3_backup_step(_M_backup, _M_pages_per_step);
+    switch (rc) {
+        case SQLITE_DONE:
+            _M_done = true;
+            return false;
+        case SQLITE_OK:
+        case SQLITE_BUSY:
+        case SQLITE_LOCKED:
+            return true;
+        default:
+            errors::throws(rc, "sqlite3_backup_step");
+    }
+    return true;
+}
+
+void sqlcipherxx::backup::run(progress_callback const &progress) {
+    while (step()) {
+        if (progress && !progress(pagecount() - remaining(), pagecount()))
+            errors::throws(SQLITE_INTERRUPT, "backup cancelled");
+        if (_M_sleep.count() > 0)
+            std::this_thread::sleep_for(_M_sleep);
+    }
+    if (progress)
+        progress(pagecount(), pagecount());
+}
+
+int sqlcipherxx::backup::remaining() const {
+    return sqlite3_backup_remaining(_M_backup);
+}
+
+int sqlcipherxx::backup::pagecount() const {
+    return sqlite3_backup_pagecount(_M_backup);
+}
+
 void sqlcipherxx::lock() {
     return get_mutex()->lock();
 }
@@ -325,6 +1260,51 @@ std::string sqlcipherxx::db_filename() const {
     return p ? p : "";
 }
 
+std::vector<unsigned char> sqlcipherxx::serialize(std::string const &schema) {
+    sqlite3_int64 size = 0;
+    unsigned char *p = sqlite3_serialize(_M_db, schema.c_str(), &size, 0);
+    if (p == NULL) {
+        // an empty database has nothing to serialize
+        if (size == 0 && sqlite3_errcode(_M_db) == SQLITE_OK)
+            return std::vector<unsigned char>();
+        throws(SQLITE_NOMEM, "sqlite3_serialize");
+    }
+    std::vector<unsigned char> image(p, p + size);
+    sqlite3_free(p);
+    return image;
+}
+
+sqlcipherxx::blob_view sqlcipherxx::serialize_view(std::string const &schema) {
+    sqlite3_int64 size = 0;
+    unsigned char *p = sqlite3_serialize(
+            _M_db, schema.c_str(), &size, SQLITE_SERIALIZE_NOCOPY);
+    if (p == NULL)
+        return blob_view();
+    return blob_view(p, static_cast<std::size_t>(size));
+}
+
+void sqlcipherxx::deserialize(
+        blob_view const &image,
+        bool readonly,
+        std::string const &schema) {
+    // sqlite takes ownership of the buffer, so it must come from sqlite3_malloc
+    sqlite3_int64 size = static_cast<sqlite3_int64>(image.size());
+    unsigned char *p = static_cast<unsigned char*>(
+            sqlite3_malloc64(image.empty() ? 1 : image.size()));
+    if (p == NULL)
+        throws(SQLITE_NOMEM, "sqlite3_malloc64");
+    if (!image.empty())
+        std::copy(image.begin(), image.end(), p);
+    unsigned flags = SQLITE_DESERIALIZE_FREEONCLOSE;
+    flags |= readonly ? SQLITE_DESERIALIZE_READONLY : SQLITE_DESERIALIZE_RESIZEABLE;
+    // frees p itself on failure
+    int rc = sqlite3_deserialize(_M_db, schema.c_str(), p, size, size, flags);
+    if (rc != SQLITE_OK)
+        throws(rc, "sqlite3_deserialize");
+    // cached statements were prepared against the replaced schema
+    _M_cache->clear();
+}
+
 int sqlcipherxx::limit(int category) {
     return sqlite3_limit(_M_db, category, -1);
 }
@@ -340,10 +1320,65 @@ void sqlcipherxx::set_extended_errcode(bool on) {
         throws(rc, "sqlite3_extended_result_codes");
 }
 
+void sqlcipherxx::set_busy_policy(std::shared_ptr<busy_policy> const &policy) {
+    if (_M_db) {
+        int rc = policy
+            ? sqlite3_busy_handler(_M_db, busy_handler, policy.get())
+            : sqlite3_busy_handler(_M_db, NULL, NULL);
+        if (SQLITE_OK != rc)
+            throws(rc, "sqlite3_busy_handler");
+    }
+    _M_busy = policy;
+}
+
+std::shared_ptr<busy_policy> sqlcipherxx::get_busy_policy() const {
+    return _M_busy;
+}
+
+void sqlcipherxx::set_busy_timeout(int ms) {
+    int rc = sqlite3_busy_timeout(_M_db, ms);
+    if (SQLITE_OK != rc)
+        throws(rc, "sqlite3_busy_timeout");
+    _M_busy.reset();
+}
+
+void sqlcipherxx::set_wal_hook(wal_hook const &hook) {
+    _M_wal_hook = hook;
+    if (_M_db) {
+        if (_M_wal_hook)
+            sqlite3_wal_hook(_M_db, wal_handler, &_M_wal_hook);
+        else
+            sqlite3_wal_hook(_M_db, NULL, NULL);
+    }
+}
+
+void sqlcipherxx::wal_autocheckpoint(int frames) {
+    int rc = sqlite3_wal_autocheckpoint(_M_db, frames);
+    if (SQLITE_OK != rc)
+        throws(rc, "sqlite3_wal_autocheckpoint");
+    // auto-checkpoint is itself a wal hook and has replaced ours
+    _M_wal_hook = wal_hook();
+}
+
+bool sqlcipherxx::checkpoint(
+        int mode,
+        int &frames,
+        int &checkpointed,
+        std::string const &schema) {
+    frames = checkpointed = 0;
+    int rc = sqlite3_wal_checkpoint_v2(
+            _M_db, schema.c_str(), mode, &frames, &checkpointed);
+    if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+        return false;
+    if (rc != SQLITE_OK)
+        throws(rc, "sqlite3_wal_checkpoint_v2");
+    return true;
+}
+
 void sqlcipherxx::throws(int ecode, std::string const &message) {
     std::ostringstream es;
     es << errors::message(ecode, message) << ": " << db_filename();
-    throw std::runtime_error(es.str());
+    throw sqlite_error(make_sqlite_error(ecode), es.str());
 }
 
 std::shared_ptr<sqlcipherxx::mutex>
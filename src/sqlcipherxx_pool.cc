@@ -0,0 +1,124 @@
+#include <stdexcept>
+
+#include "sqlcipherxx_pool.hpp"
+
+namespace org {
+
+sqlcipherxx_pool::sqlcipherxx_pool(
+        std::string const &filename,
+        std::size_t size,
+        initializer const &init,
+        int flags,
+        std::string const &vfs)
+    : _M_filename(filename)
+    , _M_slots(size)
+    , _M_idle(size)
+{
+    if (size == 0)
+        throw std::invalid_argument("sqlcipherxx_pool: size must be positive");
+    for (std::size_t i = 0; i < size; ++i) {
+        slot &s = _M_slots[i];
+        s.connection.reset(new sqlcipherxx(filename, flags, vfs));
+        s.busy = false;
+        if (init)
+            init(*s.connection);
+    }
+}
+
+sqlcipherxx_pool::~sqlcipherxx_pool() {
+    std::unique_lock<std::mutex> locker(_M_mutex);
+    _M_cond.wait(locker, [this] { return _M_idle == _M_slots.size(); });
+}
+
+std::shared_ptr<sqlcipherxx_pool::lease>
+sqlcipherxx_pool::acquire() {
+    std::thread::id self = std::this_thread::get_id();
+    std::unique_lock<std::mutex> locker(_M_mutex);
+    _M_cond.wait(locker, [this] { return _M_idle > 0; });
+    return take(pick(self), self);
+}
+
+std::shared_ptr<sqlcipherxx_pool::lease>
+sqlcipherxx_pool::try_acquire(std::chrono::milliseconds timeout) {
+    std::thread::id self = std::this_thread::get_id();
+    std::unique_lock<std::mutex> locker(_M_mutex);
+    if (!_M_cond.wait_for(locker, timeout, [this] { return _M_idle > 0; }))
+        return std::shared_ptr<lease>();
+    return take(pick(self), self);
+}
+
+std::size_t sqlcipherxx_pool::size() const {
+    return _M_slots.size();
+}
+
+std::size_t sqlcipherxx_pool::idle() const {
+    std::unique_lock<std::mutex> locker(_M_mutex);
+    return _M_idle;
+}
+
+std::string sqlcipherxx_pool::filename() const {
+    return _M_filename;
+}
+
+std::size_t sqlcipherxx_pool::pick(std::thread::id const &self) const {
+    // prefer the connection this thread had last, then one nobody has
+    // claimed yet, and only then steal another thread's connection
+    std::size_t unowned = _M_slots.size();
+    std::size_t any = _M_slots.size();
+    for (std::size_t i = 0, n = _M_slots.size(); i < n; ++i) {
+        slot const &s = _M_slots[i];
+        if (s.busy)
+            continue;
+        if (s.owner == self)
+            return i;
+        if (s.owner == std::thread::id()) {
+            if (unowned == n)
+                unowned = i;
+        } else if (any == n) {
+            any = i;
+        }
+    }
+    return unowned != _M_slots.size() ? unowned : any;
+}
+
+std::shared_ptr<sqlcipherxx_pool::lease>
+sqlcipherxx_pool::take(std::size_t i, std::thread::id const &self) {
+    slot &s = _M_slots[i];
+    s.busy = true;
+    s.owner = self;
+    --_M_idle;
+    return std::shared_ptr<lease>(new lease(*this, i));
+}
+
+void sqlcipherxx_pool::release(std::size_t i) {
+    {
+        std::unique_lock<std::mutex> locker(_M_mutex);
+        _M_slots[i].busy = false;
+        ++_M_idle;
+    }
+    _M_cond.notify_all();
+}
+
+sqlcipherxx_pool::lease::lease(sqlcipherxx_pool &pool, std::size_t i)
+    : _M_pool(pool)
+    , _M_slot(i)
+{
+}
+
+sqlcipherxx_pool::lease::~lease() {
+    _M_pool.release(_M_slot);
+}
+
+sqlcipherxx& sqlcipherxx_pool::lease::operator*() const {
+    return get();
+}
+
+sqlcipherxx* sqlcipherxx_pool::lease::operator->() const {
+    return &get();
+}
+
+sqlcipherxx& sqlcipherxx_pool::lease::get() const {
+    return *_M_pool._M_slots[_M_slot].connection;
+}
+
+}  // namespace org
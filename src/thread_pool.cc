@@ -0,0 +1,62 @@
+#include <stdexcept>
+#include <utility>
+
+#include "thread_pool.hpp"
+
+namespace org {
+
+thread_pool::thread_pool(std::size_t nthreads)
+    : _M_stopping(false)
+{
+    if (nthreads == 0)
+        throw std::invalid_argument("thread_pool: no threads");
+    _M_threads.reserve(nthreads);
+    for (std::size_t i = 0; i < nthreads; ++i)
+        _M_threads.push_back(std::thread(&thread_pool::run, this));
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::unique_lock<std::mutex> locker(_M_mutex);
+        _M_stopping = true;
+    }
+    _M_cond.notify_all();
+    for (std::size_t i = 0; i < _M_threads.size(); ++i)
+        _M_threads[i].join();
+}
+
+void thread_pool::post(task const &fn) {
+    {
+        std::unique_lock<std::mutex> locker(_M_mutex);
+        if (_M_stopping)
+            throw std::logic_error("thread_pool: stopping");
+        _M_queue.push_back(fn);
+    }
+    _M_cond.notify_one();
+}
+
+std::size_t thread_pool::size() const {
+    return _M_threads.size();
+}
+
+void thread_pool::run() {
+    for (;;) {
+        task fn;
+        {
+            std::unique_lock<std::mutex> locker(_M_mutex);
+            _M_cond.wait(locker, [this] {
+                return _M_stopping || !_M_queue.empty();
+            });
+            if (_M_queue.empty())
+                return;
+            fn = std::move(_M_queue.front());
+            _M_queue.pop_front();
+        }
+        try {
+            fn();
+        } catch (...) {
+        }
+    }
+}
+
+}  // namespace org
@@ -0,0 +1,169 @@
+#include <cctype>
+#include <stdexcept>
+
+#include "wal_router.hpp"
+
+namespace {
+typedef org::sqlcipherxx_pool::lease lease;
+typedef org::sqlcipherxx::statement statement;
+
+// keeps the lease alive until the statement has gone back to its cache
+struct leased_statement {
+    std::shared_ptr<lease> connection;
+    std::shared_ptr<statement> stmt;
+};
+
+std::shared_ptr<statement> hold(
+        std::shared_ptr<lease> const &connection,
+        std::shared_ptr<statement> const &stmt) {
+    std::shared_ptr<leased_statement> holder(new leased_statement());
+    holder->connection = connection;
+    holder->stmt = stmt;
+    return std::shared_ptr<statement>(holder, holder->stmt.get());
+}
+
+// The first keyword of sql, upper-cased, after whitespace and comments.
+std::string leading_keyword(std::string const &sql) {
+    std::size_t i = 0, n = sql.size();
+    while (i < n) {
+        if (std::isspace(static_cast<unsigned char>(sql[i]))) {
+            ++i;
+        } else if (sql.compare(i, 2, "--") == 0) {
+            i = sql.find('\n', i);
+            if (i == std::string::npos)
+                i = n;
+        } else if (sql.compare(i, 2, "/*") == 0) {
+            i = sql.find("*/", i + 2);
+            i = i == std::string::npos ? n : i + 2;
+        } else {
+            break;
+        }
+    }
+    std::string word;
+    for (; i < n && std::isalpha(static_cast<unsigned char>(sql[i])); ++i)
+        word += static_cast<char>(
+                std::toupper(static_cast<unsigned char>(sql[i])));
+    return word;
+}
+
+org::sqlcipherxx_pool::initializer writer_initializer(
+        org::sqlcipherxx_pool::initializer const &init) {
+    return [init] (org::sqlcipherxx &s) {
+        if (init)
+            init(s);
+        s.execute("PRAGMA journal_mode=WAL");
+    };
+}
+}
+
+namespace org {
+
+wal_router::wal_router(
+        std::string const &filename,
+        std::size_t nreaders,
+        initializer const &init,
+        std::string const &vfs)
+    // the writer creates the file and switches it to WAL before any reader
+    // opens it read-only
+    : _M_writer(
+            filename, 1, writer_initializer(init),
+            SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, vfs)
+    , _M_readers(
+            filename, nreaders, init,
+            SQLITE_OPEN_READONLY, vfs)
+{
+}
+
+wal_router::~wal_router() {
+}
+
+std::shared_ptr<sqlcipherxx::statement>
+wal_router::prepare(std::string const &sql) {
+    // only these can be read-only; everything else goes to the writer
+    // without tying up a reader
+    std::string verb = leading_keyword(sql);
+    if (verb == "SELECT" || verb == "VALUES" || verb == "WITH") {
+        std::shared_ptr<lease> reader = _M_readers.acquire();
+        sqlcipherxx &s = reader->get();
+        // a WITH clause may lead into a write, which must not end up in the
+        // reader's statement cache
+        if (verb != "WITH" || s.prepare(sql)->readonly())
+            return hold(reader, s.prepare_cached(sql));
+    }
+    std::shared_ptr<lease> writer = _M_writer.acquire();
+    return hold(writer, writer->get().prepare_cached(sql));
+}
+
+int wal_router::write(
+        std::function<void(sqlcipherxx&)> const &fn,
+        sqlcipherxx::retry_policy const &retry) {
+    std::shared_ptr<lease> writer = _M_writer.acquire();
+    return writer->get().run_in_transaction(sqlcipherxx::immediate, fn, retry);
+}
+
+void wal_router::read(std::function<void(sqlcipherxx&)> const &fn) {
+    std::shared_ptr<lease> reader = _M_readers.acquire();
+    fn(reader->get());
+}
+
+void wal_router::read(
+        sqlcipherxx::snapshot const &snap,
+        std::function<void(sqlcipherxx&)> const &fn) {
+    std::shared_ptr<lease> reader = _M_readers.acquire();
+    std::shared_ptr<sqlcipherxx::transaction> tran =
+        reader->get().snapshot_open(snap);
+    try {
+        fn(reader->get());
+    } catch (...) {
+        tran->abandon();
+        throw;
+    }
+    tran->commit();
+}
+
+std::shared_ptr<wal_router::snapshot_handle> wal_router::snapshot() {
+    if (!sqlcipherxx::snapshot_supported())
+        throw std::logic_error("wal_router: snapshots are not supported");
+    std::shared_ptr<lease> reader = _M_readers.acquire();
+    sqlcipherxx &s = reader->get();
+    std::shared_ptr<sqlcipherxx::transaction> tran = s.begin_deferred();
+    try {
+        // starts the read transaction the snapshot is taken in
+        s.execute("SELECT COUNT(*) FROM main.sqlite_master");
+        std::shared_ptr<sqlcipherxx::snapshot> snap = s.snapshot_get();
+        return std::shared_ptr<snapshot_handle>(
+                new snapshot_handle(reader, tran, snap));
+    } catch (...) {
+        tran->abandon();
+        throw;
+    }
+}
+
+wal_router::snapshot_handle::snapshot_handle(
+        std::shared_ptr<lease> const &reader,
+        std::shared_ptr<sqlcipherxx::transaction> const &tran,
+        std::shared_ptr<sqlcipherxx::snapshot> const &snap)
+    : _M_reader(reader)
+    , _M_tran(tran)
+    , _M_snapshot(snap)
+{
+}
+
+wal_router::snapshot_handle::~snapshot_handle() {
+    // ends the read transaction before the reader goes back to the pool
+    _M_tran->abandon();
+}
+
+sqlcipherxx::snapshot const& wal_router::snapshot_handle::get() const {
+    return *_M_snapshot;
+}
+
+sqlcipherxx_pool& wal_router::writer() {
+    return _M_writer;
+}
+
+sqlcipherxx_pool& wal_router::readers() {
+    return _M_readers;
+}
+
+}  // namespace org
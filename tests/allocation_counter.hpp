@@ -0,0 +1,52 @@
+#ifndef ALLOCATION_COUNTER_HPP_INCLUDED
+#define ALLOCATION_COUNTER_HPP_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <streambuf>
+
+// Counts heap allocations by replacing the global operator new. The
+// replacements are definitions, so include this from one file per program.
+
+namespace org {
+namespace test {
+
+inline std::atomic<std::size_t>& allocations() {
+    static std::atomic<std::size_t> count(0);
+    return count;
+}
+
+// Throws away everything written to it without allocating, so only the
+// writer's own allocations are counted.
+class discard_buf : public std::streambuf {
+    protected:
+        virtual int_type overflow(int_type c) {
+            return traits_type::not_eof(c);
+        }
+
+        virtual std::streamsize xsputn(char const*, std::streamsize n) {
+            return n;
+        }
+};
+
+}
+}
+
+void* operator new(std::size_t size) {
+    org::test::allocations().fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+#endif // ALLOCATION_COUNTER_HPP_INCLUDED
@@ -0,0 +1,76 @@
+#include <ostream>
+
+#include <benchmark/benchmark.h>
+
+#include "log_timestamp.hpp"
+#include "logging.hpp"
+
+#include "allocation_counter.hpp"
+
+// Heap allocations per log line, counted by replacing the global operator
+// new. In steady state LOGI should not allocate at all, in either mode;
+// LoggingTest.SteadyStateDoesNotAllocate checks that.
+// BM_Timestamp compares the cost of each log_timestamp mode.
+
+using org::test::allocations;
+
+namespace {
+
+org::test::discard_buf sink_buffer;
+std::ostream discard(&sink_buffer);
+
+}
+
+static void log_lines(benchmark::State &state, bool async) {
+    org::logging *logger = org::logging::instance();
+    std::ostream *orig = logger->tie(&discard);
+    if (async)
+        logger->start_async();
+    // warm the per-thread buffer and, in async mode, the ring's cells
+    for (int i = 0; i < 20000; ++i)
+        LOGI("warm up " << i);
+    logger->flush();
+
+    std::size_t before = allocations().load();
+    std::int64_t i = 0;
+    for (auto _ : state) {
+        LOGI("request " << i << " took " << 1.5 * i << "ms, status=" << "ok");
+        ++i;
+    }
+    logger->flush();
+    std::size_t allocated = allocations().load() - before;
+
+    state.counters["allocs/line"] = benchmark::Counter(
+            static_cast<double>(allocated) / state.iterations());
+    state.SetItemsProcessed(state.iterations());
+    if (async)
+        logger->stop_async();
+    logger->tie(orig);
+}
+
+static void BM_LogLineSync(benchmark::State &state) {
+    log_lines(state, false);
+}
+BENCHMARK(BM_LogLineSync);
+
+static void BM_LogLineAsync(benchmark::State &state) {
+    log_lines(state, true);
+}
+BENCHMARK(BM_LogLineAsync);
+
+static void BM_Timestamp(benchmark::State &state) {
+    using org::log_timestamp;
+
+    log_timestamp::mode orig = log_timestamp::get_mode();
+    log_timestamp::mode m = static_cast<log_timestamp::mode>(state.range(0));
+    log_timestamp::set_mode(m);
+    char buffer[log_timestamp::buffer_size];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(log_timestamp::format(buffer));
+        benchmark::ClobberMemory();
+    }
+    log_timestamp::set_mode(orig);
+    static char const *const names[] = {"seconds", "microseconds", "monotonic"};
+    state.SetLabel(names[m]);
+}
+BENCHMARK(BM_Timestamp)->DenseRange(0, 2);
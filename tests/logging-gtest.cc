@@ -0,0 +1,211 @@
+#include <cstddef>
+#include <cstring>
+
+#include <chrono>
+#include <future>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "log_ring.hpp"
+#include "log_sink.hpp"
+#include "log_timestamp.hpp"
+#include "logging.hpp"
+
+#include "allocation_counter.hpp"
+
+namespace {
+
+// holds every write until the gate opens
+class gated_buf : public std::stringbuf {
+    public:
+        explicit gated_buf(std::shared_future<void> const &gate)
+            : _M_gate(gate)
+        {
+        }
+    protected:
+        virtual std::streamsize xsputn(char const *s, std::streamsize n) {
+            _M_gate.wait();
+            return std::stringbuf::xsputn(s, n);
+        }
+    private:
+        std::shared_future<void> _M_gate;
+};
+
+// logs while a record is being built
+struct noisy {
+};
+
+std::ostream& operator<<(std::ostream &out, noisy const&) {
+    LOGW("inner");
+    return out << "noisy";
+}
+
+std::size_t count_lines(std::string const &text) {
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < text.size(); ++i)
+        if (text[i] == '\n')
+            ++n;
+    return n;
+}
+
+}
+
+TEST(LogRingTest, DeliversEveryRecordOnce) {
+    org::log_ring ring(100);
+    EXPECT_EQ(128u, ring.capacity());
+
+    int const nthreads = 4;
+    int const per_thread = 10000;
+    std::vector<std::thread> producers;
+    for (int t = 0; t < nthreads; ++t) {
+        producers.push_back(std::thread([&ring, t] {
+            for (int i = 0; i < per_thread; ++i) {
+                std::string record = std::to_string(t * per_thread + i);
+                while (!ring.push(record.data(), record.size()))
+                    std::this_thread::yield();
+            }
+        }));
+    }
+    std::set<std::string> seen;
+    while (seen.size() < static_cast<std::size_t>(nthreads * per_thread)) {
+        if (!ring.pop([&seen] (std::string const &r) { seen.insert(r); }))
+            std::this_thread::yield();
+    }
+    for (std::size_t i = 0; i < producers.size(); ++i)
+        producers[i].join();
+    EXPECT_FALSE(ring.pop([] (std::string const&) {}));
+    EXPECT_EQ(ring.pushed(), ring.popped());
+}
+
+TEST(AsyncSinkTest, CountsRecordsLostToAFullRing) {
+    std::promise<void> open;
+    gated_buf buf(open.get_future().share());
+    std::ostream out(&buf);
+
+    org::async_sink::options opts;
+    opts.capacity = 4;
+    opts.batch_size = 1;
+    opts.overflow = org::async_sink::count;
+    {
+        org::async_sink sink(&out, opts);
+        for (int i = 0; i < 100; ++i)
+            sink.write("x\n", 2);
+        EXPECT_GE(sink.dropped(), 90u);
+        open.set_value();
+        sink.flush();
+    }
+    std::string text = buf.str();
+    EXPECT_NE(std::string::npos, text.find("record(s) dropped"));
+    EXPECT_LE(count_lines(text), 11u);
+}
+
+TEST(LoggingTest, AsyncModeKeepsEveryLine) {
+    org::logging *logger = org::logging::instance();
+    std::ostringstream out;
+    std::ostream *orig = logger->tie(&out);
+    logger->start_async();
+    EXPECT_TRUE(logger->is_async());
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.push_back(std::thread([t] {
+            for (int i = 0; i < 1000; ++i)
+                LOGI("thread " << t << " line " << i);
+        }));
+    }
+    for (std::size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    logger->flush();
+    EXPECT_EQ(4000u, count_lines(out.str()));
+
+    logger->stop_async();
+    EXPECT_FALSE(logger->is_async());
+    LOGW("synchronous again");
+    EXPECT_EQ(4001u, count_lines(out.str()));
+    EXPECT_EQ(0u, logger->dropped());
+    logger->tie(orig);
+}
+
+TEST(LoggingTest, SteadyStateDoesNotAllocate) {
+    org::logging *logger = org::logging::instance();
+    org::test::discard_buf buf;
+    std::ostream discard(&buf);
+    std::ostream *orig = logger->tie(&discard);
+    for (int async = 0; async < 2; ++async) {
+        if (async)
+            logger->start_async();
+        // warms the per-thread buffer and, in async mode, the ring's cells
+        for (int i = 0; i < 20000; ++i)
+            LOGI("warm up " << i);
+        logger->flush();
+
+        std::size_t before = org::test::allocations().load();
+        for (int i = 0; i < 1000; ++i)
+            LOGI("request " << i << " took " << 1.5 * i << "ms, status=" << "ok");
+        logger->flush();
+        std::size_t allocated = org::test::allocations().load() - before;
+        EXPECT_EQ(0u, allocated) << (async ? "async" : "sync");
+        if (async)
+            logger->stop_async();
+    }
+    logger->tie(orig);
+}
+
+TEST(LoggingTest, NestedRecordsGetTheirOwnBuffer) {
+    org::logging *logger = org::logging::instance();
+    std::ostringstream out;
+    std::ostream *orig = logger->tie(&out);
+
+    for (int i = 0; i < 2; ++i)
+        LOGI("outer " << noisy() << " done");
+    logger->tie(orig);
+
+    std::istringstream lines(out.str());
+    std::string line;
+    std::vector<std::string> seen;
+    while (std::getline(lines, line))
+        seen.push_back(line);
+    ASSERT_EQ(4u, seen.size());
+    EXPECT_NE(std::string::npos, seen[0].find(" W "));
+    EXPECT_NE(std::string::npos, seen[0].find("inner"));
+    EXPECT_NE(std::string::npos, seen[1].find("outer noisy done"));
+    EXPECT_EQ(std::string::npos, seen[1].find("inner"));
+    EXPECT_NE(std::string::npos, seen[3].find("outer noisy done"));
+}
+
+TEST(LogTimestampTest, FormatsEachMode) {
+    using org::log_timestamp;
+
+    log_timestamp::mode orig = log_timestamp::get_mode();
+    char buffer[log_timestamp::buffer_size];
+
+    log_timestamp::set_mode(log_timestamp::seconds);
+    std::size_t n = log_timestamp::format(buffer);
+    EXPECT_EQ(std::strlen(buffer), n);
+    EXPECT_TRUE(std::regex_match(buffer, std::regex(
+                    "\\d{4}-\\d{2}-\\d{2} \\d{2}:\\d{2}:\\d{2} [+-]\\d{4}")))
+        << buffer;
+
+    log_timestamp::set_mode(log_timestamp::microseconds);
+    log_timestamp::format(buffer);
+    EXPECT_TRUE(std::regex_match(buffer, std::regex(
+                    "\\d{4}-\\d{2}-\\d{2} \\d{2}:\\d{2}:\\d{2}\\.\\d{6} [+-]\\d{4}")))
+        << buffer;
+
+    log_timestamp::set_mode(log_timestamp::monotonic);
+    log_timestamp::format(buffer);
+    EXPECT_TRUE(std::regex_match(buffer, std::regex("\\d+\\.\\d{6}")))
+        << buffer;
+    std::string first(buffer);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    log_timestamp::format(buffer);
+    EXPECT_GT(std::stod(buffer), std::stod(first));
+
+    log_timestamp::set_mode(orig);
+}
@@ -0,0 +1,44 @@
+#ifndef SCRATCH_FILE_HPP_INCLUDED
+#define SCRATCH_FILE_HPP_INCLUDED
+
+#include <cstdio>
+#include <string>
+
+namespace org {
+namespace test {
+
+// A database file (with its journal, WAL and shared memory files) that is
+// removed before and after use.
+class scratch_file {
+    public:
+        explicit scratch_file(std::string const &name)
+            : _M_name(name)
+        {
+            remove();
+        }
+
+        ~scratch_file() {
+            remove();
+        }
+
+        std::string const& name() const {
+            return _M_name;
+        }
+    private:
+        void remove() {
+            std::remove(_M_name.c_str());
+            std::remove((_M_name + "-journal").c_str());
+            std::remove((_M_name + "-wal").c_str());
+            std::remove((_M_name + "-shm").c_str());
+        }
+
+        std::string _M_name;
+
+        scratch_file(scratch_file const&);
+        scratch_file& operator=(scratch_file const&);
+};
+
+}
+}
+
+#endif // SCRATCH_FILE_HPP_INCLUDED
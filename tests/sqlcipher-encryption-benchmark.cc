@@ -0,0 +1,163 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "cipher_profile.hpp"
+#include "kdf_cache.hpp"
+#include "sqlcipherxx.hpp"
+
+#include "scratch_file.hpp"
+
+// Cost of SQLCipher page encryption against plaintext, across page sizes and
+// HMAC on/off, plus the key derivation cost per kdf_iter.
+//
+// Arguments of the read/write benchmarks are (encrypted, page size, hmac).
+// Bytes/s is payload throughput, items/s rows per second.
+
+using org::test::scratch_file;
+
+namespace {
+
+std::size_t const payload_size = 256;
+int const rows_per_iteration = 1000;
+int const table_rows = 20000;
+
+void open(
+        org::sqlcipherxx &s,
+        std::string const &filename,
+        benchmark::State const &state) {
+    bool encrypted = state.range(0) != 0;
+    org::cipher_profile profile;
+    profile.page_size = static_cast<int>(state.range(1));
+    profile.use_hmac = state.range(2) != 0;
+    // keep the KDF out of the page cost
+    profile.kdf_iter = 1;
+    s.open(filename, profile);
+    if (encrypted) {
+        s.key("benchmark");
+    } else {
+        s.execute("PRAGMA page_size = " + std::to_string(profile.page_size));
+    }
+    // a small page cache makes every scan go through the codec again
+    s.execute("PRAGMA cache_size = 16");
+}
+
+void label(benchmark::State &state) {
+    std::string l = state.range(0) ? "encrypted" : "plaintext";
+    if (state.range(0))
+        l += state.range(2) ? " hmac" : " no-hmac";
+    state.SetLabel(l);
+}
+
+void page_arguments(benchmark::internal::Benchmark *b) {
+    for (int page = 1024; page <= 65536; page *= 2) {
+        b->Args({0, page, 0});
+        b->Args({1, page, 0});
+        b->Args({1, page, 1});
+    }
+}
+
+std::vector<unsigned char> payload() {
+    std::vector<unsigned char> bytes(payload_size);
+    for (std::size_t i = 0; i < bytes.size(); ++i)
+        bytes[i] = static_cast<unsigned char>(i * 131);
+    return bytes;
+}
+
+}
+
+static void BM_Write(benchmark::State &state) {
+    using org::sqlcipherxx;
+
+    scratch_file file("encryption-write.db");
+    sqlcipherxx s;
+    open(s, file.name(), state);
+    s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, payload BLOB)");
+    std::shared_ptr<sqlcipherxx::statement> insert =
+        s.prepare("INSERT INTO t(payload) VALUES(?)");
+    std::vector<unsigned char> bytes = payload();
+
+    for (auto _ : state) {
+        std::shared_ptr<sqlcipherxx::transaction> tran = s.begin_immediate();
+        for (int i = 0; i < rows_per_iteration; ++i) {
+            insert->bind(1, bytes);
+            insert->execute();
+        }
+        tran->commit();
+    }
+    state.SetBytesProcessed(state.iterations() * rows_per_iteration * payload_size);
+    state.SetItemsProcessed(state.iterations() * rows_per_iteration);
+    label(state);
+}
+BENCHMARK(BM_Write)->Apply(page_arguments)->Unit(benchmark::kMillisecond);
+
+static void BM_Read(benchmark::State &state) {
+    using org::sqlcipherxx;
+
+    scratch_file file("encryption-read.db");
+    sqlcipherxx s;
+    open(s, file.name(), state);
+    s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, payload BLOB)");
+    {
+        std::shared_ptr<sqlcipherxx::transaction> tran = s.begin_immediate();
+        std::shared_ptr<sqlcipherxx::statement> insert =
+            s.prepare("INSERT INTO t(payload) VALUES(?)");
+        std::vector<unsigned char> bytes = payload();
+        for (int i = 0; i < table_rows; ++i) {
+            insert->bind(1, bytes);
+            insert->execute();
+        }
+        tran->commit();
+    }
+    std::shared_ptr<sqlcipherxx::statement> scan =
+        s.prepare("SELECT payload FROM t");
+
+    for (auto _ : state) {
+        std::size_t bytes = 0;
+        while (scan->next())
+            bytes += scan->get_blob(0).size();
+        scan->reset();
+        benchmark::DoNotOptimize(bytes);
+    }
+    state.SetBytesProcessed(state.iterations() * table_rows * payload_size);
+    state.SetItemsProcessed(state.iterations() * table_rows);
+    label(state);
+}
+BENCHMARK(BM_Read)->Apply(page_arguments)->Unit(benchmark::kMillisecond);
+
+// open + key + first read, with and without the kdf_cache
+static void BM_OpenKeyed(benchmark::State &state) {
+    using org::cipher_profile;
+    using org::kdf_cache;
+    using org::sqlcipherxx;
+
+    scratch_file file("encryption-open.db");
+    cipher_profile profile;
+    profile.kdf_iter = static_cast<int>(state.range(0));
+    bool cached = state.range(1) != 0;
+    {
+        sqlcipherxx s;
+        s.open(file.name(), profile);
+        s.key("benchmark");
+        s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY)");
+    }
+
+    for (auto _ : state) {
+        if (!cached)
+            kdf_cache::instance()->clear();
+        sqlcipherxx s;
+        s.open(file.name(), profile);
+        s.key("benchmark");
+        std::shared_ptr<sqlcipherxx::statement> stmt =
+            s.prepare("SELECT COUNT(*) FROM t");
+        stmt->next();
+        benchmark::DoNotOptimize(stmt->get_int64(0));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(cached ? "kdf cached" : "kdf per open");
+}
+BENCHMARK(BM_OpenKeyed)
+    ->ArgsProduct({{4000, 64000, 256000}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,1242 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "async_db.hpp"
+#include "bulk_inserter.hpp"
+#include "busy_policy.hpp"
+#include "checkpointer.hpp"
+#include "group_committer.hpp"
+#include "kdf_cache.hpp"
+#include "sqlcipherxx.hpp"
+#include "sqlcipherxx_coro.hpp"
+#include "sqlcipherxx_pool.hpp"
+#include "wal_router.hpp"
+
+#include "scratch_file.hpp"
+
+using org::test::scratch_file;
+
+TEST(PoolTest, ReusesConnectionPerThread) {
+    using org::sqlcipherxx;
+    using org::sqlcipherxx_pool;
+
+    scratch_file file("pool.db");
+    std::atomic<int> opened(0);
+    sqlcipherxx_pool pool(file.name(), 2, [&opened] (sqlcipherxx &s) {
+        s.set_extended_errcode(true);
+        ++opened;
+    });
+    EXPECT_EQ(2, opened);
+    EXPECT_EQ(2u, pool.idle());
+
+    sqlcipherxx *first = NULL;
+    {
+        std::shared_ptr<sqlcipherxx_pool::lease> l = pool.acquire();
+        first = &l->get();
+        EXPECT_EQ(1u, pool.idle());
+    }
+    EXPECT_EQ(2u, pool.idle());
+    {
+        std::shared_ptr<sqlcipherxx_pool::lease> l = pool.acquire();
+        EXPECT_EQ(first, &l->get());
+        std::shared_ptr<sqlcipherxx_pool::lease> other = pool.acquire();
+        EXPECT_NE(first, &other->get());
+        EXPECT_FALSE(pool.try_acquire(std::chrono::milliseconds(10)));
+    }
+
+    std::vector<std::thread> threads;
+    std::atomic<int> failures(0);
+    for (int i = 0; i < 4; ++i)
+        threads.push_back(std::thread([&pool, &failures] {
+            for (int j = 0; j < 50; ++j) {
+                std::shared_ptr<sqlcipherxx_pool::lease> l = pool.acquire();
+                if (!l->get())
+                    ++failures;
+            }
+        }));
+    for (std::size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    EXPECT_EQ(0, failures);
+    EXPECT_EQ(2, opened);
+}
+
+TEST(StatementCacheTest, ReturnsResetStatements) {
+    using org::sqlcipherxx;
+    typedef sqlcipherxx::statement statement;
+
+    scratch_file file("cache.db");
+    sqlcipherxx s(file.name());
+    s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, v STRING)");
+    s.execute("INSERT INTO t(v) VALUES('a'), ('b')");
+
+    std::string const sql = "SELECT v FROM t WHERE id >= ? ORDER BY id";
+    statement *first = NULL;
+    {
+        std::shared_ptr<statement> stmt = s.prepare_cached(sql);
+        first = stmt.get();
+        stmt->set_double(1, 1);
+        ASSERT_TRUE(stmt->next());
+        EXPECT_EQ("a", stmt->get_string(0));
+        // a concurrent user of the same text gets its own statement
+        std::shared_ptr<statement> other = s.prepare_cached(sql);
+        EXPECT_NE(first, other.get());
+    }
+    std::shared_ptr<statement> stmt = s.prepare_cached(sql);
+    // bindings were cleared, so id >= NULL matches nothing
+    EXPECT_FALSE(stmt->next());
+    stmt->reset();
+    stmt->set_double(1, 2);
+    ASSERT_TRUE(stmt->next());
+    EXPECT_EQ("b", stmt->get_string(0));
+
+    s.set_statement_cache_size(0);
+    stmt.reset();
+    s.close();
+}
+
+TEST(StatementCacheTest, SharedByThreadsOnOneConnection) {
+    using org::sqlcipherxx;
+    typedef sqlcipherxx::statement statement;
+
+    scratch_file file("cache-threads.db");
+    sqlcipherxx s(file.name());
+    s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, v STRING)");
+    s.execute("INSERT INTO t(v) VALUES('a'), ('b')");
+
+    std::string const sql = "SELECT v FROM t WHERE id = ?";
+    int const nthreads = 4;
+    std::mutex mutex;
+    std::set<statement*> seen;
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t) {
+        threads.push_back(std::thread([&, t] {
+            for (int i = 0; i < 200; ++i) {
+                std::shared_ptr<statement> stmt = s.prepare_cached(sql);
+                {
+                    std::unique_lock<std::mutex> locker(mutex);
+                    seen.insert(stmt.get());
+                }
+                stmt->set_int64(1, 1 + (t + i) % 2);
+                if (!stmt->next()
+                        || stmt->get_string(0) != ((t + i) % 2 ? "b" : "a"))
+                    ++failures;
+            }
+        }));
+    }
+    for (std::size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    EXPECT_EQ(0, failures);
+    // statements are handed back and reused, at most one per thread
+    EXPECT_LE(seen.size(), static_cast<std::size_t>(nthreads));
+}
+
+TEST(StatementTest, ViewsHonourColumnBytes) {
+    using org::sqlcipherxx;
+    typedef sqlcipherxx::statement statement;
+
+    scratch_file file("views.db");
+    sqlcipherxx s(file.name());
+    std::shared_ptr<statement> stmt = s.prepare(
+            "SELECT CAST(x'610062' AS TEXT), x'00ff', NULL");
+    ASSERT_TRUE(stmt->next());
+
+    bool null = true;
+    std::string_view text = stmt->get_view(0, &null);
+    EXPECT_FALSE(null);
+    EXPECT_EQ(std::string_view("a\0b", 3), text);
+    EXPECT_EQ(3u, stmt->get_string(0).size());
+
+    sqlcipherxx::blob_view blob = stmt->get_blob(1, &null);
+    EXPECT_FALSE(null);
+    ASSERT_EQ(2u, blob.size());
+    EXPECT_EQ(0x00, blob[0]);
+    EXPECT_EQ(0xff, blob[1]);
+
+    EXPECT_TRUE(stmt->get_view(2, &null).empty());
+    EXPECT_TRUE(null);
+    EXPECT_TRUE(stmt->get_blob(2, &null).empty());
+    EXPECT_TRUE(null);
+}
+
+TEST(StatementTest, TypedBindAndGet) {
+    using org::sqlcipherxx;
+    typedef sqlcipherxx::statement statement;
+
+    scratch_file file("typed.db");
+    sqlcipherxx s(file.name());
+    s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, n INTEGER, b BLOB, z BLOB)");
+
+    sqlite3_int64 const big = 9007199254740993LL;  // 2^53 + 1, lost in a double
+    std::vector<unsigned char> bytes;
+    bytes.push_back(1);
+    bytes.push_back(0);
+    bytes.push_back(2);
+    std::shared_ptr<statement> insert = s.prepare(
+            "INSERT INTO t(id, n, b, z) VALUES(?, ?, ?, ?)");
+    insert->bind(1, 7);
+    insert->bind(2, big);
+    insert->bind(3, bytes);
+    insert->set_zeroblob(4, 16);
+    insert->execute();
+
+    std::shared_ptr<statement> select = s.prepare(
+            "SELECT id, n, b, length(z) FROM t WHERE id = ?");
+    select->set_int64(1, 7);
+    ASSERT_TRUE(select->next());
+    EXPECT_EQ(7, select->get<int>(0));
+    EXPECT_EQ(big, select->get_int64(1));
+    EXPECT_EQ(big, select->get<sqlite3_int64>(1));
+    EXPECT_EQ(bytes, select->get<std::vector<unsigned char> >(2));
+    EXPECT_EQ(16, select->get<int>(3));
+}
+
+TEST(StatementTest, BindAllAndDecodeRows) {
+    using org::sqlcipherxx;
+    typedef sqlcipherxx::statement statement;
+
+    scratch_file file("rows.db");
+    sqlcipherxx s(file.name());
+    s.execute("CREATE TABLE student(id INTEGER PRIMARY KEY, sno INTEGER, sname STRING)");
+    std::shared_ptr<statement> insert = s.prepare(
+            "INSERT INTO student(id, sno, sname) VALUES(?, ?, ?)");
+    insert->bind_all(1, 100, "one");
+    insert->execute();
+    std::string const two = "two";
+    insert->bind_all(2, 200, two);
+    insert->execute();
+    EXPECT_THROW(insert->bind_all(3, 300), std::runtime_error);
+
+    std::shared_ptr<statement> select = s.prepare(
+            "SELECT id, sno, sname FROM student ORDER BY id");
+    std::vector<std::string> names;
+    sqlite3_int64 sum = 0;
+    for (auto [id, sno, sname] :
+            select->rows<sqlite3_int64, sqlite3_int64, std::string_view>()) {
+        sum += id + sno;
+        names.push_back(std::string(sname));
+    }
+    EXPECT_EQ(303, sum);
+    ASSERT_EQ(2u, names.size());
+    EXPECT_EQ("one", names[0]);
+    EXPECT_EQ("two", names[1]);
+
+    select->reset();
+    EXPECT_THROW((select->rows<int, int, int, int>()), std::runtime_error);
+}
+
+TEST(AsyncDbTest, PipelinesQueries) {
+    using org::async_db;
+    using org::sqlcipherxx;
+
+    scratch_file file("async.db");
+    async_db db(file.name(), 4, [](sqlcipherxx &s) {
+        s.set_busy_timeout(5000);
+    });
+    db.submit([](sqlcipherxx &s) {
+        s.execute("PRAGMA journal_mode=WAL");
+        s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT, data BLOB)");
+    }).get();
+
+    std::vector<std::future<async_db::result_set>> inserts;
+    for (int i = 0; i < 20; ++i) {
+        std::vector<async_db::value> params;
+        params.push_back("row" + std::to_string(i));
+        if (i % 2)
+            params.push_back(std::vector<unsigned char>(3, static_cast<unsigned char>(i)));
+        else
+            params.push_back(nullptr);
+        inserts.push_back(db.submit(
+                    "INSERT INTO t(name, data) VALUES(?, ?)", params));
+    }
+    for (std::size_t i = 0; i < inserts.size(); ++i)
+        EXPECT_EQ(1, inserts[i].get().changes);
+
+    async_db::result_set rs = db.submit(
+            "SELECT id, name, data FROM t WHERE id <= ? ORDER BY id",
+            std::vector<async_db::value>(1, sqlite3_int64(2))).get();
+    ASSERT_EQ(3u, rs.columns.size());
+    EXPECT_EQ("name", rs.columns[1]);
+    ASSERT_EQ(2u, rs.rows.size());
+    EXPECT_EQ(1, std::get<sqlite3_int64>(rs.rows[0][0]));
+    EXPECT_TRUE(std::holds_alternative<std::string>(rs.rows[1][1]));
+
+    rs = db.submit("SELECT data FROM t WHERE data IS NULL OR id = 1").get();
+    std::size_t nulls = 0;
+    for (std::size_t i = 0; i < rs.rows.size(); ++i)
+        if (std::holds_alternative<std::nullptr_t>(rs.rows[i][0]))
+            ++nulls;
+    EXPECT_EQ(10u, nulls);
+
+    std::future<sqlite3_int64> count = db.submit([](sqlcipherxx &s) {
+        std::shared_ptr<sqlcipherxx::statement> c =
+            s.prepare("SELECT COUNT(*) FROM t");
+        c->next();
+        return c->get_int64(0);
+    });
+    EXPECT_EQ(20, count.get());
+    EXPECT_THROW(db.submit("SELECT * FROM missing").get(), org::sqlite_error);
+}
+
+#if defined(__cpp_impl_coroutine)
+namespace {
+
+org::task<void> create_table(org::async_db &db) {
+    co_await org::with_connection(db, [](org::sqlcipherxx &s) {
+        s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY)");
+        s.execute("INSERT INTO t(id) VALUES(1), (2), (3)");
+    });
+}
+
+org::task<sqlite3_int64> count_rows(org::async_db &db) {
+    co_await create_table(db);
+    org::async_db::result_set rs =
+        co_await org::query(db, "SELECT COUNT(*) FROM t");
+    co_return std::get<sqlite3_int64>(rs.rows[0][0]);
+}
+
+org::task<void> query_missing(org::async_db &db) {
+    co_await org::query(db, "SELECT * FROM missing");
+}
+
+org::task<int> walk(
+        org::thread_pool &pool,
+        org::sqlcipherxx::statement &stmt) {
+    int n = 0;
+    while (co_await org::next_async(pool, stmt))
+        ++n;
+    co_return n;
+}
+
+}
+
+TEST(CoroutineTest, AwaitsOnPoolThreads) {
+    using org::sqlcipherxx;
+
+    scratch_file file("coroutine.db");
+    org::async_db db(file.name(), 2);
+    EXPECT_EQ(3, org::spawn(count_rows(db)).get());
+
+    sqlcipherxx s(file.name());
+    std::shared_ptr<sqlcipherxx::statement> ids = s.prepare("SELECT id FROM t");
+    org::thread_pool pool(1);
+    EXPECT_EQ(3, org::spawn(walk(pool, *ids)).get());
+
+    EXPECT_THROW(org::spawn(query_missing(db)).get(), org::sqlite_error);
+}
+#endif
+
+TEST(BulkInserterTest, BatchesAndCommits) {
+    using org::bulk_inserter;
+    using org::sqlcipherxx;
+    typedef sqlcipherxx::statement statement;
+
+    scratch_file file("bulk.db");
+    sqlcipherxx s(file.name());
+    s.limit(SQLITE_LIMIT_VARIABLE_NUMBER, 30);
+    s.execute("CREATE TABLE student(id INTEGER PRIMARY KEY, sno INTEGER, sname STRING)");
+
+    std::vector<std::string> columns;
+    columns.push_back("sno");
+    columns.push_back("sname");
+    {
+        bulk_inserter inserter(s, "student", columns, 40);
+        EXPECT_EQ(15u, inserter.rows_per_statement());
+        for (int i = 0; i < 100; ++i)
+            inserter.insert(i, "s" + std::to_string(i));
+        inserter.insert(nullptr, nullptr);
+        EXPECT_THROW(inserter.insert(1), std::invalid_argument);
+        // 80 committed by the batches, the rest by flush()
+        EXPECT_EQ(80u, inserter.inserted());
+        inserter.flush();
+        EXPECT_EQ(101u, inserter.inserted());
+    }
+
+    std::shared_ptr<statement> stmt = s.prepare(
+            "SELECT COUNT(*), SUM(sno), MAX(sname), COUNT(sname) FROM student");
+    ASSERT_TRUE(stmt->next());
+    EXPECT_EQ(101, stmt->get<int>(0));
+    EXPECT_EQ(4950, stmt->get<int>(1));
+    EXPECT_EQ("s99", stmt->get<std::string>(2));
+    EXPECT_EQ(100, stmt->get<int>(3));
+}
+
+TEST(BulkInserterTest, ConstraintErrorRollsBackTheBatch) {
+    using org::bulk_inserter;
+    using org::sqlcipherxx;
+    typedef sqlcipherxx::statement statement;
+
+    scratch_file file("bulk-error.db");
+    sqlcipherxx s(file.name());
+    s.limit(SQLITE_LIMIT_VARIABLE_NUMBER, 30);
+    s.execute("CREATE TABLE student(id INTEGER PRIMARY KEY, sno INTEGER UNIQUE, sname STRING)");
+
+    std::vector<std::string> columns;
+    columns.push_back("sno");
+    columns.push_back("sname");
+    auto count = [&s] {
+        std::shared_ptr<statement> c = s.prepare("SELECT COUNT(*) FROM student");
+        c->next();
+        return c->get<int>(0);
+    };
+    {
+        bulk_inserter inserter(s, "student", columns, 40);
+        // the first statement (15 rows) goes through, the second one holds
+        // a duplicate and fails when it is written
+        for (int i = 0; i < 29; ++i)
+            inserter.insert(i, "ok");
+        EXPECT_THROW(inserter.insert(0, "duplicate"), org::sqlite_error);
+        EXPECT_EQ(0u, inserter.inserted());
+        EXPECT_TRUE(s.autocommit());
+
+        // still usable, and the destructor commits only what follows
+        inserter.insert(100, "after");
+    }
+    EXPECT_EQ(1, count());
+
+    {
+        bulk_inserter inserter(s, "student", columns, 40);
+        inserter.insert(100, "duplicate");
+        EXPECT_THROW(inserter.flush(), org::sqlite_error);
+        EXPECT_EQ(0u, inserter.inserted());
+    }
+    EXPECT_EQ(1, count());
+}
+
+TEST(BulkInserterTest, JoinsTheCallersTransaction) {
+    using org::bulk_inserter;
+    using org::sqlcipherxx;
+
+    scratch_file file("bulk-nested.db");
+    sqlcipherxx s(file.name());
+    s.execute("CREATE TABLE student(id INTEGER PRIMARY KEY, sname STRING)");
+
+    std::vector<std::string> columns(1, "sname");
+    auto count = [&s] {
+        std::shared_ptr<sqlcipherxx::statement> c =
+            s.prepare("SELECT COUNT(*) FROM student");
+        c->next();
+        return c->get<int>(0);
+    };
+
+    std::shared_ptr<sqlcipherxx::transaction> tran = s.begin_immediate();
+    {
+        bulk_inserter inserter(s, "student", columns, 10);
+        for (int i = 0; i < 25; ++i)
+            inserter.insert("name");
+        inserter.flush();
+        EXPECT_EQ(25u, inserter.inserted());
+    }
+    EXPECT_FALSE(s.autocommit());
+    EXPECT_EQ(25, count());
+    tran->rollback();
+    EXPECT_EQ(0, count());
+
+    tran = s.begin_immediate();
+    {
+        bulk_inserter inserter(s, "student", columns, 10);
+        inserter.insert("kept");
+    }
+    tran->commit();
+    EXPECT_EQ(1, count());
+}
+
+TEST(ErrorCodeTest, BusyIsReportedWithoutThrowing) {
+    using org::sqlcipherxx;
+    typedef sqlcipherxx::statement statement;
+
+    scratch_file file("busy.db");
+    sqlcipherxx writer(file.name());
+    writer.execute("CREATE TABLE t(id INTEGER PRIMARY KEY)");
+    sqlcipherxx other(file.name());
+
+    std::shared_ptr<sqlcipherxx::transaction> tran = writer.begin_immediate();
+    std::error_code ec;
+    EXPECT_FALSE(other.try_execute("BEGIN IMMEDIATE", ec));
+    EXPECT_TRUE(org::is_busy(ec));
+    EXPECT_EQ(std::errc::resource_unavailable_try_again, ec);
+    EXPECT_EQ(SQLITE_BUSY, ec.value());
+
+    std::shared_ptr<statement> stmt = other.try_prepare(
+            "INSERT INTO t(id) VALUES(1)", ec);
+    ASSERT_TRUE(stmt);
+    EXPECT_FALSE(ec);
+    EXPECT_FALSE(stmt->try_next(ec));
+    EXPECT_TRUE(org::is_busy(ec));
+    stmt->try_execute(ec);
+    EXPECT_TRUE(org::is_busy(ec));
+
+    // dropping a statement right after a failed step must not throw
+    stmt = other.prepare("INSERT INTO t(id) VALUES(1)");
+    EXPECT_FALSE(stmt->try_next(ec));
+    EXPECT_TRUE(org::is_busy(ec));
+    stmt.reset();
+    stmt = other.prepare("INSERT INTO t(id) VALUES(1)");
+    EXPECT_THROW(stmt->next(), org::sqlite_error);
+    stmt.reset();
+
+    EXPECT_FALSE(other.try_prepare("SELECT * FROM missing", ec));
+    EXPECT_EQ(SQLITE_ERROR, ec.value());
+    try {
+        other.prepare("SELECT * FROM missing");
+        FAIL();
+    } catch (org::sqlite_error const &e) {
+        EXPECT_EQ(org::make_sqlite_error(SQLITE_ERROR), e.code());
+    }
+
+    tran->commit();
+    EXPECT_TRUE(other.try_execute("INSERT INTO t(id) VALUES(1)", ec));
+    EXPECT_FALSE(ec);
+}
+
+TEST(BusyPolicyTest, WaitsThenGivesUp) {
+    using org::busy_policy;
+    using org::sqlcipherxx;
+
+    scratch_file file("backoff.db");
+    sqlcipherxx writer(file.name());
+    writer.execute("CREATE TABLE t(id INTEGER PRIMARY KEY)");
+    sqlcipherxx other(file.name());
+    std::shared_ptr<busy_policy> policy(new busy_policy(
+                busy_policy::exponential(std::chrono::milliseconds(30))));
+    other.set_busy_policy(policy);
+
+    std::shared_ptr<sqlcipherxx::transaction> tran = writer.begin_immediate();
+    std::error_code ec;
+    EXPECT_FALSE(other.try_execute("BEGIN IMMEDIATE", ec));
+    EXPECT_TRUE(org::is_busy(ec));
+    busy_policy::statistics stats = policy->stats();
+    EXPECT_EQ(1u, stats.events);
+    EXPECT_EQ(1u, stats.gave_up);
+    EXPECT_GT(stats.waits, 1u);
+    EXPECT_GE(stats.waited.count(), 20000);
+
+    std::thread releaser([&tran] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        tran->commit();
+    });
+    EXPECT_TRUE(other.try_execute("BEGIN IMMEDIATE", ec));
+    releaser.join();
+    other.execute("COMMIT");
+    EXPECT_EQ(2u, policy->stats().events);
+    EXPECT_EQ(1u, policy->stats().gave_up);
+}
+
+TEST(TransactionTest, RetriesBusyUnitsOfWork) {
+    using org::sqlcipherxx;
+
+    scratch_file file("retry.db");
+    sqlcipherxx writer(file.name());
+    writer.execute("CREATE TABLE t(id INTEGER PRIMARY KEY)");
+    sqlcipherxx other(file.name());
+    other.set_extended_errcode(true);
+
+    std::shared_ptr<sqlcipherxx::transaction> tran = writer.begin_immediate();
+    std::vector<int> retries;
+    sqlcipherxx::retry_policy policy;
+    policy.max_attempts = 50;
+    policy.on_retry = [&retries, &tran] (int attempt, std::error_code const &ec) {
+        EXPECT_TRUE(org::is_busy(ec));
+        retries.push_back(attempt);
+        if (attempt == 3)
+            tran->commit();
+    };
+    int runs = 0;
+    int attempts = other.run_in_transaction(
+            sqlcipherxx::immediate,
+            [&runs] (sqlcipherxx &s) {
+                ++runs;
+                s.execute("INSERT INTO t(id) VALUES(1)");
+            },
+            policy);
+    EXPECT_EQ(4, attempts);
+    EXPECT_EQ(1, runs);
+    ASSERT_EQ(3u, retries.size());
+    EXPECT_TRUE(other.autocommit());
+
+    // non-busy failures are rolled back and not retried
+    runs = 0;
+    EXPECT_THROW(other.run_in_transaction(
+                sqlcipherxx::deferred,
+                [&runs] (sqlcipherxx &s) {
+                    ++runs;
+                    s.execute("INSERT INTO t(id) VALUES(2)");
+                    s.execute("INSERT INTO t(id) VALUES(1)");
+                }),
+            org::sqlite_error);
+    EXPECT_EQ(1, runs);
+    EXPECT_TRUE(other.autocommit());
+    std::shared_ptr<sqlcipherxx::statement> count = other.prepare("SELECT COUNT(*) FROM t");
+    ASSERT_TRUE(count->next());
+    EXPECT_EQ(1, count->get<int>(0));
+}
+
+TEST(TransactionTest, SavepointsNestInsideTransaction) {
+    using org::sqlcipherxx;
+
+    scratch_file file("savepoint.db");
+    sqlcipherxx s(file.name());
+    s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY)");
+
+    std::shared_ptr<sqlcipherxx::transaction> tran = s.begin_immediate();
+    {
+        std::shared_ptr<sqlcipherxx::savepoint> kept = s.begin_savepoint();
+        s.execute("INSERT INTO t(id) VALUES(1)");
+        {
+            std::shared_ptr<sqlcipherxx::savepoint> undone =
+                s.begin_savepoint("inner");
+            EXPECT_EQ("inner", undone->name());
+            s.execute("INSERT INTO t(id) VALUES(2)");
+            undone->rollback();
+        }
+        kept->release();
+    }
+    EXPECT_FALSE(s.autocommit());
+    tran->commit();
+    EXPECT_TRUE(s.autocommit());
+
+    std::shared_ptr<sqlcipherxx::statement> ids = s.prepare("SELECT id FROM t");
+    std::vector<int> seen;
+    for (auto [id] : ids->rows<int>())
+        seen.push_back(id);
+    ASSERT_EQ(1u, seen.size());
+    EXPECT_EQ(1, seen[0]);
+}
+
+TEST(BackupTest, CopiesInSteps) {
+    using org::sqlcipherxx;
+
+    scratch_file from("backup-source.db");
+    scratch_file to("backup-dest.db");
+    sqlcipherxx src(from.name());
+    src.execute("PRAGMA page_size = 1024");
+    src.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, payload BLOB)");
+    {
+        std::shared_ptr<sqlcipherxx::transaction> tran = src.begin_immediate();
+        std::shared_ptr<sqlcipherxx::statement> insert =
+            src.prepare("INSERT INTO t(payload) VALUES(zeroblob(512))");
+        for (int i = 0; i < 100; ++i)
+            insert->execute();
+        tran->commit();
+    }
+
+    sqlcipherxx dst(to.name());
+    std::shared_ptr<sqlcipherxx::backup> b =
+        src.begin_backup(dst, 4, std::chrono::microseconds(0));
+    int calls = 0;
+    std::int64_t last = -1;
+    b->run([&](std::int64_t done, std::int64_t total) {
+        EXPECT_GE(done, last);
+        EXPECT_LE(done, total);
+        last = done;
+        ++calls;
+        return true;
+    });
+    EXPECT_EQ(0, b->remaining());
+    EXPECT_GT(calls, 10);
+    b.reset();
+
+    std::shared_ptr<sqlcipherxx::statement> count =
+        dst.prepare("SELECT COUNT(*) FROM t");
+    ASSERT_TRUE(count->next());
+    EXPECT_EQ(100, count->get_int64(0));
+
+    scratch_file cancelled("backup-cancelled.db");
+    sqlcipherxx other(cancelled.name());
+    b = src.begin_backup(other, 1, std::chrono::microseconds(0));
+    EXPECT_THROW(b->run([](std::int64_t, std::int64_t) { return false; }),
+            org::sqlite_error);
+}
+
+TEST(BackupTest, CopiesEncryptedDatabases) {
+    using org::sqlcipherxx;
+
+    scratch_file from("backup-keyed-source.db");
+    sqlcipherxx src(from.name());
+    src.key("source");
+    {
+        std::shared_ptr<sqlcipherxx::statement> version =
+            src.prepare("PRAGMA cipher_version");
+        if (!version->next())
+            GTEST_SKIP() << "sqlite built without SQLCipher";
+    }
+    src.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, payload BLOB)");
+    src.execute("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1"
+            " FROM n WHERE i < 100) INSERT INTO t(payload)"
+            " SELECT zeroblob(512) FROM n");
+
+    // encrypted to encrypted, under another passphrase
+    scratch_file to("backup-keyed-dest.db");
+    {
+        sqlcipherxx dst(to.name());
+        dst.key("dest");
+        std::shared_ptr<sqlcipherxx::backup> b =
+            src.begin_backup(dst, 4, std::chrono::microseconds(0));
+        b->run();
+        EXPECT_EQ(0, b->remaining());
+    }
+    {
+        sqlcipherxx dst(to.name());
+        dst.key("dest");
+        std::shared_ptr<sqlcipherxx::statement> count =
+            dst.prepare("SELECT COUNT(*) FROM t");
+        ASSERT_TRUE(count->next());
+        EXPECT_EQ(100, count->get_int64(0));
+    }
+    {
+        sqlcipherxx dst(to.name());
+        dst.key("source");
+        EXPECT_THROW(dst.execute("SELECT COUNT(*) FROM t"), org::sqlite_error);
+    }
+}
+
+TEST(BackupTest, RefusesEncryptedToPlaintext) {
+    using org::sqlcipherxx;
+
+    scratch_file from("backup-keyed-only.db");
+    sqlcipherxx src(from.name());
+    src.key("source");
+    {
+        std::shared_ptr<sqlcipherxx::statement> version =
+            src.prepare("PRAGMA cipher_version");
+        if (!version->next())
+            GTEST_SKIP() << "sqlite built without SQLCipher";
+    }
+    src.execute("CREATE TABLE t(id INTEGER PRIMARY KEY)");
+    src.execute("INSERT INTO t(id) VALUES(1)");
+
+    // export_to() is the way to a plaintext copy
+    scratch_file plain("backup-plain-dest.db");
+    sqlcipherxx dst(plain.name());
+    EXPECT_THROW({
+        std::shared_ptr<sqlcipherxx::backup> b =
+            src.begin_backup(dst, 4, std::chrono::microseconds(0));
+        b->run();
+    }, org::sqlite_error);
+}
+
+TEST(SerializeTest, LoadsImageIntoMemory) {
+    using org::sqlcipherxx;
+
+    scratch_file file("serialize.db");
+    std::vector<unsigned char> image;
+    {
+        sqlcipherxx s(file.name());
+        s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT)");
+        s.execute("INSERT INTO t(name) VALUES('alpha'), ('beta')");
+        image = s.serialize();
+    }
+    ASSERT_FALSE(image.empty());
+
+    sqlcipherxx m(":memory:");
+    m.deserialize(sqlcipherxx::blob_view(image.data(), image.size()), true);
+    std::shared_ptr<sqlcipherxx::statement> names =
+        m.prepare("SELECT name FROM t ORDER BY id");
+    std::vector<std::string> seen;
+    for (auto [name] : names->rows<std::string>())
+        seen.push_back(name);
+    ASSERT_EQ(2u, seen.size());
+    EXPECT_EQ("beta", seen[1]);
+    EXPECT_THROW(m.execute("INSERT INTO t(name) VALUES('gamma')"),
+            org::sqlite_error);
+
+    sqlcipherxx::blob_view borrowed = m.serialize_view();
+    ASSERT_EQ(image.size(), borrowed.size());
+    EXPECT_TRUE(std::equal(image.begin(), image.end(), borrowed.begin()));
+
+    sqlcipherxx w(":memory:");
+    w.deserialize(sqlcipherxx::blob_view(image.data(), image.size()), false);
+    w.execute("INSERT INTO t(name) VALUES('gamma')");
+    EXPECT_GT(w.serialize().size(), 0u);
+}
+
+TEST(GroupCommitterTest, BatchesWritesFromManyThreads) {
+    using org::group_committer;
+    using org::sqlcipherxx;
+
+    scratch_file file("group.db");
+    sqlcipherxx writer(file.name());
+    writer.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, n INTEGER)");
+
+    std::atomic<int> failures(0);
+    {
+        group_committer committer(writer, 64, std::chrono::milliseconds(1));
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i)
+            threads.push_back(std::thread([&committer, &failures, i] {
+                std::vector<std::future<void> > pending;
+                for (int j = 0; j < 25; ++j) {
+                    int id = i * 100 + j;
+                    pending.push_back(committer.submit([id] (sqlcipherxx &s) {
+                        std::shared_ptr<sqlcipherxx::statement> stmt =
+                            s.prepare_cached("INSERT INTO t(id, n) VALUES(?, ?)");
+                        stmt->bind_all(id, 1);
+                        stmt->execute();
+                    }));
+                }
+                for (std::size_t j = 0; j < pending.size(); ++j) {
+                    try {
+                        pending[j].get();
+                    } catch (...) {
+                        ++failures;
+                    }
+                }
+            }));
+        for (std::size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+
+        // a failing closure only fails its own future
+        std::future<void> bad = committer.submit([] (sqlcipherxx &s) {
+            s.execute("INSERT INTO t(id, n) VALUES(1000, 1)");
+            s.execute("INSERT INTO t(id, n) VALUES(0, 1)");
+        });
+        EXPECT_THROW(bad.get(), org::sqlite_error);
+
+        group_committer::statistics stats = committer.stats();
+        EXPECT_EQ(101u, stats.writes);
+        EXPECT_EQ(1u, stats.failed);
+        EXPECT_LT(stats.batches, stats.writes);
+    }
+    EXPECT_EQ(0, failures);
+
+    std::shared_ptr<sqlcipherxx::statement> count =
+        writer.prepare("SELECT COUNT(*), SUM(n) FROM t");
+    ASSERT_TRUE(count->next());
+    EXPECT_EQ(100, count->get<int>(0));
+    EXPECT_EQ(100, count->get<int>(1));
+}
+
+TEST(GroupCommitterTest, RolledBackTransactionFailsTheBatch) {
+    using org::group_committer;
+    using org::sqlcipherxx;
+
+    scratch_file file("group-rollback.db");
+    sqlcipherxx writer(file.name());
+    writer.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, n INTEGER)");
+    writer.execute("INSERT INTO t(id, n) VALUES(0, 0)");
+
+    std::atomic<int> calls(0);
+    auto insert = [&calls] (int id) {
+        return [&calls, id] (sqlcipherxx &s) {
+            ++calls;
+            std::shared_ptr<sqlcipherxx::statement> stmt =
+                s.prepare_cached("INSERT INTO t(id, n) VALUES(?, 1)");
+            stmt->bind_all(id);
+            stmt->execute();
+        };
+    };
+
+    {
+        // the linger holds the first closure until all three are queued
+        group_committer committer(writer, 3, std::chrono::seconds(10));
+        std::future<void> first = committer.submit(insert(1));
+        std::future<void> bad = committer.submit([&calls] (sqlcipherxx &s) {
+            ++calls;
+            s.execute("INSERT OR ROLLBACK INTO t(id, n) VALUES(0, 1)");
+        });
+        std::future<void> last = committer.submit(insert(2));
+        EXPECT_THROW(first.get(), org::sqlite_error);
+        EXPECT_THROW(bad.get(), org::sqlite_error);
+        EXPECT_THROW(last.get(), org::sqlite_error);
+        EXPECT_EQ(2, calls);
+        EXPECT_EQ(3u, committer.stats().failed);
+    }
+
+    // a busy COMMIT is retried without running the closure again
+    sqlcipherxx reader(file.name());
+    std::shared_ptr<sqlcipherxx::transaction> tran = reader.begin_deferred();
+    reader.execute("SELECT COUNT(*) FROM t");
+    writer.set_busy_timeout(0);
+    group_committer committer(writer);
+    std::future<void> retried = committer.submit(insert(3));
+    while (committer.stats().retries == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    tran->commit();
+    retried.get();
+    EXPECT_EQ(3, calls);
+
+    std::shared_ptr<sqlcipherxx::statement> count =
+        reader.prepare("SELECT COUNT(*), SUM(n) FROM t");
+    ASSERT_TRUE(count->next());
+    EXPECT_EQ(2, count->get<int>(0));
+    EXPECT_EQ(1, count->get<int>(1));
+}
+
+TEST(WalRouterTest, RoutesByStatementKind) {
+    using org::sqlcipherxx;
+    using org::wal_router;
+    typedef sqlcipherxx::statement statement;
+
+    scratch_file file("router.db");
+    wal_router router(file.name(), 2);
+    router.write([] (sqlcipherxx &s) {
+        s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY)");
+    });
+    {
+        std::shared_ptr<statement> insert =
+            router.prepare("INSERT INTO t(id) VALUES(?)");
+        EXPECT_FALSE(insert->readonly());
+        EXPECT_EQ(0u, router.writer().idle());
+        EXPECT_EQ(2u, router.readers().idle());
+        insert->bind(1, 1);
+        insert->execute();
+    }
+    EXPECT_EQ(1u, router.writer().idle());
+
+    std::shared_ptr<statement> select = router.prepare("SELECT COUNT(*) FROM t");
+    EXPECT_TRUE(select->readonly());
+    EXPECT_EQ(1u, router.readers().idle());
+    ASSERT_TRUE(select->next());
+    EXPECT_EQ(1, select->get<int>(0));
+    select.reset();
+    EXPECT_EQ(2u, router.readers().idle());
+
+    std::error_code ec;
+    router.read([&ec] (sqlcipherxx &s) {
+        s.try_execute("INSERT INTO t(id) VALUES(2)", ec);
+    });
+    EXPECT_EQ(SQLITE_READONLY, ec.value() & 0xff);
+
+    // with every reader taken, writes still go straight to the writer
+    std::shared_ptr<statement> first = router.prepare(" select 1");
+    std::shared_ptr<statement> second =
+        router.prepare("/* count */ WITH n AS (SELECT 1) SELECT * FROM n");
+    EXPECT_TRUE(second->readonly());
+    EXPECT_EQ(0u, router.readers().idle());
+    std::shared_ptr<statement> update =
+        router.prepare("-- bump\nUPDATE t SET id = id + 10");
+    EXPECT_FALSE(update->readonly());
+    update->execute();
+    update.reset();
+    first.reset();
+
+    std::shared_ptr<statement> with_insert = router.prepare(
+            "WITH n(i) AS (VALUES(3)) INSERT INTO t(id) SELECT i FROM n");
+    EXPECT_FALSE(with_insert->readonly());
+    EXPECT_EQ(1u, router.readers().idle());
+    with_insert->execute();
+}
+
+TEST(WalRouterTest, ReadersShareSnapshot) {
+    using org::sqlcipherxx;
+
+    scratch_file file("snapshot.db");
+    // one reader stays with the snapshot, two serve the reads
+    org::wal_router router(file.name(), 3);
+    router.write([](sqlcipherxx &s) {
+        s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY)");
+        s.execute("INSERT INTO t(id) VALUES(1)");
+    });
+    if (!sqlcipherxx::snapshot_supported()) {
+        EXPECT_THROW(router.snapshot(), std::logic_error);
+        GTEST_SKIP() << "built without SQLITE_ENABLE_SNAPSHOT";
+    }
+    std::shared_ptr<org::wal_router::snapshot_handle> before = router.snapshot();
+
+    // a checkpoint cannot reset the WAL past the snapshot
+    router.write([](sqlcipherxx &s) {
+        s.execute("INSERT INTO t(id) VALUES(2)");
+    });
+    {
+        std::shared_ptr<org::sqlcipherxx_pool::lease> writer =
+            router.writer().acquire();
+        int frames = 0;
+        int checkpointed = 0;
+        writer->get().checkpoint(
+                SQLITE_CHECKPOINT_PASSIVE, frames, checkpointed);
+    }
+    router.write([](sqlcipherxx &s) {
+        s.execute("INSERT INTO t(id) VALUES(3)");
+    });
+
+    auto count = [](sqlcipherxx &s) {
+        std::shared_ptr<sqlcipherxx::statement> c =
+            s.prepare("SELECT COUNT(*) FROM t");
+        c->next();
+        return c->get_int64(0);
+    };
+    std::vector<std::future<sqlite3_int64>> seen;
+    for (int i = 0; i < 2; ++i) {
+        seen.push_back(std::async(std::launch::async, [&] {
+            sqlite3_int64 n = 0;
+            router.read(before->get(), [&](sqlcipherxx &s) { n = count(s); });
+            return n;
+        }));
+    }
+    for (std::size_t i = 0; i < seen.size(); ++i)
+        EXPECT_EQ(1, seen[i].get());
+    sqlite3_int64 latest = 0;
+    router.read([&](sqlcipherxx &s) { latest = count(s); });
+    EXPECT_EQ(3, latest);
+
+    std::shared_ptr<org::wal_router::snapshot_handle> after = router.snapshot();
+    EXPECT_LT(sqlcipherxx::snapshot_cmp(before->get(), after->get()), 0);
+    EXPECT_EQ(0, sqlcipherxx::snapshot_cmp(before->get(), before->get()));
+}
+
+TEST(CheckpointerTest, CheckpointsOffTheCommitPath) {
+    using org::checkpointer;
+    using org::sqlcipherxx;
+
+    scratch_file file("checkpoint.db");
+    sqlcipherxx s(file.name());
+    s.execute("PRAGMA journal_mode=WAL");
+    s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, payload BLOB)");
+
+    checkpointer::options opts;
+    opts.passive_frames = 8;
+    opts.idle_time = std::chrono::milliseconds(100);
+    checkpointer c(s, opts);
+    std::shared_ptr<sqlcipherxx::statement> insert =
+        s.prepare("INSERT INTO t(payload) VALUES(zeroblob(2048))");
+    for (int i = 0; i < 100; ++i)
+        insert->execute();
+
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (c.stats().truncate == 0 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    checkpointer::statistics stats = c.stats();
+    EXPECT_GT(stats.passive, 0u);
+    EXPECT_EQ(1u, stats.truncate);
+    EXPECT_GT(stats.frames, 100u);
+
+    std::ifstream wal(file.name() + "-wal", std::ios::binary | std::ios::ate);
+    ASSERT_TRUE(wal.is_open());
+    EXPECT_EQ(0, static_cast<long>(wal.tellg()));
+}
+
+TEST(KeyTest, DerivedKeysAreCachedPerSalt) {
+    using org::kdf_cache;
+    using org::sqlcipherxx;
+
+    scratch_file file("keyed.db");
+    kdf_cache::instance()->clear();
+    {
+        sqlcipherxx s(file.name());
+        s.key("secret");
+        s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY)");
+        s.execute("INSERT INTO t(id) VALUES(1)");
+    }
+    // a new file has no salt to derive from yet
+    EXPECT_EQ(0u, kdf_cache::instance()->size());
+    std::size_t cached = 0;
+    for (int i = 0; i < 2; ++i) {
+        sqlcipherxx s(file.name());
+        s.key("secret");
+        std::shared_ptr<sqlcipherxx::statement> stmt =
+            s.prepare("SELECT COUNT(*) FROM t");
+        ASSERT_TRUE(stmt->next());
+        EXPECT_EQ(1, stmt->get<int>(0));
+        if (i == 0)
+            cached = kdf_cache::instance()->size();
+    }
+    // the second reopen read the same salt, so nothing new was derived
+    EXPECT_EQ(cached, kdf_cache::instance()->size());
+
+    kdf_cache::bytes salt(16, 7);
+    kdf_cache::bytes a = kdf_cache::instance()->derive(
+            "secret", salt, 1000, "PBKDF2_HMAC_SHA512");
+    kdf_cache::bytes b = kdf_cache::instance()->derive(
+            "secret", salt, 1000, "PBKDF2_HMAC_SHA256");
+    EXPECT_EQ(32u, a.size());
+    EXPECT_NE(a, b);
+    EXPECT_EQ(cached + 2, kdf_cache::instance()->size());
+    kdf_cache::instance()->clear();
+    EXPECT_EQ(0u, kdf_cache::instance()->size());
+
+    sqlcipherxx s(file.name());
+    EXPECT_THROW(s.key_raw(sqlcipherxx::blob_view(salt.data(), salt.size())),
+            std::invalid_argument);
+}
+
+TEST(KeyTest, ConnectionsKeyedBeforeTheFirstWrite) {
+    using org::sqlcipherxx;
+
+    scratch_file file("fresh-keyed.db");
+    std::vector<std::shared_ptr<sqlcipherxx> > connections;
+    for (int i = 0; i < 3; ++i) {
+        connections.push_back(std::make_shared<sqlcipherxx>(file.name()));
+        connections.back()->key("secret");
+    }
+    connections[0]->execute("CREATE TABLE t(id INTEGER PRIMARY KEY)");
+    connections[0]->execute("INSERT INTO t(id) VALUES(1)");
+    for (std::size_t i = 1; i < connections.size(); ++i) {
+        std::shared_ptr<sqlcipherxx::statement> stmt =
+            connections[i]->prepare("SELECT COUNT(*) FROM t");
+        ASSERT_TRUE(stmt->next());
+        EXPECT_EQ(1, stmt->get<int>(0));
+    }
+}
+
+TEST(KeyTest, InteroperatesWithPragmaKey) {
+    using org::sqlcipherxx;
+
+    auto count = [] (sqlcipherxx &s) {
+        std::shared_ptr<sqlcipherxx::statement> stmt =
+            s.prepare("SELECT COUNT(*) FROM t");
+        EXPECT_TRUE(stmt->next());
+        return stmt->get<int>(0);
+    };
+
+    scratch_file plain("pragma-keyed.db");
+    {
+        sqlcipherxx s(plain.name());
+        s.execute("PRAGMA key = 'secret'");
+        s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY)");
+        s.execute("INSERT INTO t(id) VALUES(1)");
+    }
+    {
+        sqlcipherxx s(plain.name());
+        s.key("secret");
+        EXPECT_EQ(1, count(s));
+    }
+
+    scratch_file keyed("key-keyed.db");
+    {
+        sqlcipherxx s(keyed.name());
+        s.key("secret");
+        s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY)");
+        s.execute("INSERT INTO t(id) VALUES(1)");
+    }
+    {
+        // the second key() derives from the salt in the header
+        sqlcipherxx s(keyed.name());
+        s.key("secret");
+        EXPECT_EQ(1, count(s));
+    }
+    sqlcipherxx s(keyed.name());
+    s.execute("PRAGMA key = 'secret'");
+    EXPECT_EQ(1, count(s));
+}
+
+TEST(KeyTest, RekeyExclusiveRoundTrip) {
+    using org::sqlcipherxx;
+
+    auto count = [] (sqlcipherxx &s) {
+        std::shared_ptr<sqlcipherxx::statement> stmt =
+            s.prepare("SELECT COUNT(*) FROM t");
+        EXPECT_TRUE(stmt->next());
+        return stmt->get<int>(0);
+    };
+
+    scratch_file file("rekey.db");
+    sqlcipherxx s(file.name());
+    s.key("old");
+    s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY)");
+    s.execute("WITH RECURSIVE n(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM n"
+            " WHERE i < 99) INSERT INTO t(id) SELECT i FROM n");
+    EXPECT_THROW(s.rekey_exclusive("new"), std::logic_error);
+    s.execute("PRAGMA journal_mode = WAL");
+
+    {
+        // refused while another connection is open, which still works
+        sqlcipherxx other(file.name());
+        other.key("old");
+        EXPECT_EQ(100, count(other));
+        s.set_busy_timeout(0);
+        EXPECT_THROW(s.rekey_exclusive("new"), org::sqlite_error);
+        other.execute("INSERT INTO t(id) VALUES(100)");
+    }
+    EXPECT_EQ(101, count(s));
+
+    {
+        // a failed copy leaves the database as it was, open to others
+        std::string target = file.name() + "-rekey";
+        std::filesystem::create_directories(target + "/blocker");
+        EXPECT_ANY_THROW(s.rekey_exclusive("new"));
+        std::filesystem::remove_all(target);
+        std::shared_ptr<sqlcipherxx::statement> mode =
+            s.prepare("PRAGMA journal_mode");
+        ASSERT_TRUE(mode->next());
+        EXPECT_EQ("wal", mode->get<std::string>(0));
+        mode.reset();
+        sqlcipherxx other(file.name());
+        other.key("old");
+        EXPECT_EQ(101, count(other));
+    }
+
+    std::shared_ptr<sqlcipherxx::statement> version =
+        s.prepare("PRAGMA cipher_version");
+    if (!version->next())
+        GTEST_SKIP() << "sqlite built without SQLCipher";
+    version.reset();
+
+    s.rekey_exclusive("new");
+    EXPECT_EQ(101, count(s));
+    s.close();
+    {
+        sqlcipherxx reopened(file.name());
+        reopened.key("new");
+        EXPECT_EQ(101, count(reopened));
+    }
+    sqlcipherxx stale(file.name());
+    stale.key("old");
+    EXPECT_THROW(stale.execute("SELECT COUNT(*) FROM t"), org::sqlite_error);
+}
+
+TEST(KeyTest, CipherProfilePresets) {
+    using org::cipher_profile;
+    using org::sqlcipherxx;
+
+    EXPECT_EQ(4096, cipher_profile::preset("compat-v4").page_size);
+    EXPECT_EQ(16384, cipher_profile::preset("throughput").page_size);
+    EXPECT_EQ(1024, cipher_profile::preset("low-memory").page_size);
+    EXPECT_THROW(cipher_profile::preset("none"), std::invalid_argument);
+
+    std::vector<std::string> pragmas = cipher_profile::throughput().pragmas("aux");
+    ASSERT_EQ(6u, pragmas.size());
+    EXPECT_EQ("PRAGMA aux.cipher_page_size = 16384", pragmas[0]);
+
+    // reads a pragma back, empty when the library does not know it
+    auto pragma = [] (sqlcipherxx &s, std::string const &name) {
+        std::shared_ptr<sqlcipherxx::statement> stmt =
+            s.prepare("PRAGMA " + name);
+        return stmt->next() ? stmt->get<std::string>(0) : std::string();
+    };
+
+    cipher_profile profile = cipher_profile::low_memory();
+    profile.kdf_iter = 64000;
+    profile.kdf_algorithm = "PBKDF2_HMAC_SHA256";
+    profile.use_hmac = false;
+
+    scratch_file file("profile.db");
+    {
+        sqlcipherxx s;
+        s.open(file.name(), profile);
+        s.key("secret");
+        s.execute("CREATE TABLE t(id INTEGER PRIMARY KEY)");
+        EXPECT_EQ(1024, s.get_cipher_profile().page_size);
+        if (pragma(s, "cipher_version").empty())
+            GTEST_SKIP() << "sqlite built without SQLCipher";
+        EXPECT_EQ("1024", pragma(s, "cipher_page_size"));
+        EXPECT_EQ("64000", pragma(s, "kdf_iter"));
+        EXPECT_EQ("0", pragma(s, "cipher_use_hmac"));
+        EXPECT_EQ("PBKDF2_HMAC_SHA256", pragma(s, "cipher_kdf_algorithm"));
+    }
+    {
+        sqlcipherxx s;
+        s.open(file.name(), profile);
+        s.key("secret");
+        EXPECT_EQ("1024", pragma(s, "cipher_page_size"));
+        s.execute("SELECT COUNT(*) FROM t");
+    }
+
+    // the SQLCipher 4 defaults cannot read it
+    sqlcipherxx s;
+    s.open(file.name(), cipher_profile::compat_v4());
+    s.key("secret");
+    EXPECT_THROW(s.execute("SELECT COUNT(*) FROM t"), org::sqlite_error);
+}